@@ -58,6 +58,7 @@ export DXVK_HUD=1
 cd "prefix/$FOLDER1/$FOLDER2"
 
 
+#remove dinput=d for games that read controllers through DirectInput
 WINEDLLOVERRIDES="dxgi,d3d11=n,b,dinput=d,winedbg=d"  wine64 $EXE_PATH #add command line arguments if needed 
 
 #or uncomment for 32bit
@@ -0,0 +1,249 @@
+/*
+ * Wayland linux-dmabuf buffers
+ *
+ * Copyright 2020 varmd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "windef.h"
+#include "winbase.h"
+
+#include "waylanddrv.h"
+#include "wine/heap.h"
+#include "wine/library.h"
+#include "wine/debug.h"
+
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(waylanddrv);
+
+/* libgbm is loaded at runtime, only the few entry points used here are
+ * declared so the driver builds without the gbm headers */
+struct gbm_device;
+struct gbm_bo;
+
+#define GBM_FORMAT_ARGB8888     0x34325241  /* 'A','R','2','4', same as DRM_FORMAT_ARGB8888 */
+#define GBM_BO_USE_RENDERING    (1 << 2)
+#define GBM_BO_USE_LINEAR       (1 << 4)
+#define GBM_BO_TRANSFER_WRITE   (1 << 1)
+#define DRM_FORMAT_MOD_LINEAR   0
+#define DRM_FORMAT_MOD_INVALID  0x00ffffffffffffffULL
+
+static void *gbm_handle;
+static struct gbm_device *(*pgbm_create_device)( int fd );
+static struct gbm_bo *(*pgbm_bo_create)( struct gbm_device *gbm, uint32_t width, uint32_t height,
+                                         uint32_t format, uint32_t flags );
+static void (*pgbm_bo_destroy)( struct gbm_bo *bo );
+static int (*pgbm_bo_get_fd)( struct gbm_bo *bo );
+static uint32_t (*pgbm_bo_get_stride)( struct gbm_bo *bo );
+static void *(*pgbm_bo_map)( struct gbm_bo *bo, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                             uint32_t flags, uint32_t *stride, void **map_data );
+static void (*pgbm_bo_unmap)( struct gbm_bo *bo, void *map_data );
+
+struct wayland_dmabuf_buffer
+{
+    struct gbm_bo    *bo;
+    struct wl_buffer *buffer;
+    int               width;
+    int               height;
+};
+
+static struct zwp_linux_dmabuf_v1 *dmabuf;
+static BOOL dmabuf_argb8888_linear;   /* ARGB8888 advertised with the linear modifier */
+static BOOL dmabuf_argb8888_implicit; /* ARGB8888 advertised without modifiers, before version 3 */
+static struct gbm_device *gbm_device;
+static int render_node_fd = -1;
+static INIT_ONCE gbm_once = INIT_ONCE_STATIC_INIT;
+
+static void dmabuf_format( void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf_v1, uint32_t format )
+{
+    /* before version 3 the formats are only usable with implicit modifiers, from
+     * version 3 on the modifier events tell which layouts can be imported */
+    if (format != GBM_FORMAT_ARGB8888) return;
+    if (zwp_linux_dmabuf_v1_get_version( zwp_linux_dmabuf_v1 ) < 3) dmabuf_argb8888_implicit = TRUE;
+}
+
+static void dmabuf_modifier( void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf_v1,
+                             uint32_t format, uint32_t modifier_hi, uint32_t modifier_lo )
+{
+    uint64_t modifier = ((uint64_t)modifier_hi << 32) | modifier_lo;
+
+    if (format != GBM_FORMAT_ARGB8888) return;
+    /* the buffer objects are linear, other modifiers are tiled or compressed layouts */
+    if (modifier == DRM_FORMAT_MOD_LINEAR) dmabuf_argb8888_linear = TRUE;
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener =
+{
+    dmabuf_format,
+    dmabuf_modifier
+};
+
+/***********************************************************************
+ *		wayland_dmabuf_init
+ *
+ * Bind the zwp_linux_dmabuf_v1 global, the supported formats arrive with
+ * the next roundtrip.
+ */
+void wayland_dmabuf_init( struct wl_registry *registry, uint32_t name, uint32_t version )
+{
+    /* buffers are created with create_immed, new in version 2 */
+    if (version < 2 || dmabuf) return;
+    dmabuf = wl_registry_bind( registry, name, &zwp_linux_dmabuf_v1_interface, min( version, 3 ));
+    zwp_linux_dmabuf_v1_add_listener( dmabuf, &dmabuf_listener, NULL );
+}
+
+static BOOL CALLBACK load_gbm( INIT_ONCE *once, void *param, void **context )
+{
+    static const char * const libgbm_candidates[] = { "libgbm.so.1", "libgbm.so", NULL };
+    char path[32];
+    int i;
+
+    for (i = 0; libgbm_candidates[i] && !gbm_handle; i++)
+        gbm_handle = wine_dlopen( libgbm_candidates[i], RTLD_NOW, NULL, 0 );
+    if (!gbm_handle)
+    {
+        TRACE( "libgbm not found, GDI windows use shm buffers\n" );
+        return TRUE;
+    }
+
+#define LOAD_FUNCPTR(f) if (!(p##f = wine_dlsym( gbm_handle, #f, NULL, 0 ))) goto fail;
+    LOAD_FUNCPTR(gbm_create_device)
+    LOAD_FUNCPTR(gbm_bo_create)
+    LOAD_FUNCPTR(gbm_bo_destroy)
+    LOAD_FUNCPTR(gbm_bo_get_fd)
+    LOAD_FUNCPTR(gbm_bo_get_stride)
+    LOAD_FUNCPTR(gbm_bo_map)
+    LOAD_FUNCPTR(gbm_bo_unmap)
+#undef LOAD_FUNCPTR
+
+    for (i = 128; i < 192 && !gbm_device; i++)
+    {
+        snprintf( path, sizeof(path), "/dev/dri/renderD%d", i );
+        if ((render_node_fd = open( path, O_RDWR | O_CLOEXEC )) < 0) continue;
+        if ((gbm_device = pgbm_create_device( render_node_fd ))) TRACE( "using render node %s\n", path );
+        else
+        {
+            close( render_node_fd );
+            render_node_fd = -1;
+        }
+    }
+    if (!gbm_device) TRACE( "no usable render node, GDI windows use shm buffers\n" );
+    return TRUE;
+
+fail:
+    WARN( "libgbm is missing entry points, GDI windows use shm buffers\n" );
+    wine_dlclose( gbm_handle, NULL, 0 );
+    gbm_handle = NULL;
+    return TRUE;
+}
+
+/***********************************************************************
+ *		wayland_dmabuf_create_buffer
+ *
+ * Create a linear ARGB8888 buffer on the render node and import it as a
+ * wl_buffer, with the linear modifier when the compositor advertised it or
+ * with an implicit one before version 3. Returns NULL when dmabuf buffers
+ * can't be used, the caller then falls back to wl_shm.
+ */
+struct wayland_dmabuf_buffer *wayland_dmabuf_create_buffer( int width, int height )
+{
+    struct zwp_linux_buffer_params_v1 *params;
+    struct wayland_dmabuf_buffer *buffer;
+    uint64_t modifier;
+    int fd;
+
+    if (!waylanddrv_config.use_dmabuf || !dmabuf) return NULL;
+    if (dmabuf_argb8888_linear) modifier = DRM_FORMAT_MOD_LINEAR;
+    else if (dmabuf_argb8888_implicit) modifier = DRM_FORMAT_MOD_INVALID;
+    else return NULL;
+    InitOnceExecuteOnce( &gbm_once, load_gbm, NULL, NULL );
+    if (!gbm_device) return NULL;
+
+    if (!(buffer = heap_alloc_zero( sizeof(*buffer) ))) return NULL;
+    buffer->width = width;
+    buffer->height = height;
+    if (!(buffer->bo = pgbm_bo_create( gbm_device, width, height, GBM_FORMAT_ARGB8888,
+                                       GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR )))
+    {
+        WARN( "failed to create a %dx%d buffer object\n", width, height );
+        heap_free( buffer );
+        return NULL;
+    }
+    if ((fd = pgbm_bo_get_fd( buffer->bo )) < 0)
+    {
+        WARN( "failed to export the buffer object\n" );
+        wayland_dmabuf_destroy_buffer( buffer );
+        return NULL;
+    }
+
+    params = zwp_linux_dmabuf_v1_create_params( dmabuf );
+    zwp_linux_buffer_params_v1_add( params, fd, 0, 0, pgbm_bo_get_stride( buffer->bo ),
+                                    modifier >> 32, modifier & 0xffffffff );
+    buffer->buffer = zwp_linux_buffer_params_v1_create_immed( params, width, height, GBM_FORMAT_ARGB8888, 0 );
+    zwp_linux_buffer_params_v1_destroy( params );
+    close( fd );
+
+    TRACE( "created %dx%d dmabuf buffer %p\n", width, height, buffer );
+    return buffer;
+}
+
+struct wl_buffer *wayland_dmabuf_get_wl_buffer( struct wayland_dmabuf_buffer *buffer )
+{
+    return buffer->buffer;
+}
+
+/***********************************************************************
+ *		wayland_dmabuf_upload
+ *
+ * Copy a rectangle of a top-down ARGB image of the buffer size into the
+ * buffer object, only the rectangle is mapped.
+ */
+BOOL wayland_dmabuf_upload( struct wayland_dmabuf_buffer *buffer, const uint32_t *bits, const RECT *rect )
+{
+    uint32_t stride, width = rect->right - rect->left;
+    void *map_data = NULL;
+    char *dst;
+    int y;
+
+    if (IsRectEmpty( rect )) return TRUE;
+    if (!(dst = pgbm_bo_map( buffer->bo, rect->left, rect->top, width, rect->bottom - rect->top,
+                             GBM_BO_TRANSFER_WRITE, &stride, &map_data )))
+    {
+        WARN( "failed to map %s of buffer %p\n", wine_dbgstr_rect( rect ), buffer );
+        return FALSE;
+    }
+    for (y = rect->top; y < rect->bottom; y++, dst += stride)
+        memcpy( dst, bits + y * buffer->width + rect->left, width * sizeof(*bits) );
+    pgbm_bo_unmap( buffer->bo, map_data );
+    return TRUE;
+}
+
+void wayland_dmabuf_destroy_buffer( struct wayland_dmabuf_buffer *buffer )
+{
+    if (buffer->buffer) wl_buffer_destroy( buffer->buffer );
+    if (buffer->bo) pgbm_bo_destroy( buffer->bo );
+    heap_free( buffer );
+}
@@ -0,0 +1,571 @@
+/*
+ * Wayland mouse driver
+ *
+ * Copyright 1998 Ulrich Weigand
+ * Copyright 2007 Henri Verbeet
+ * Copyright 2020 varmd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "windef.h"
+#include "winbase.h"
+#include "wingdi.h"
+#include "winuser.h"
+
+#include "waylanddrv.h"
+#include "wine/heap.h"
+#include "wine/list.h"
+#include "wine/debug.h"
+
+#include <wayland-cursor.h>
+
+WINE_DEFAULT_DEBUG_CHANNEL(cursor);
+
+/* a Win32 cursor converted to wl_shm buffers, one per animation frame */
+struct cursor_frame
+{
+    struct wl_buffer *buffer;
+    int               width;      /* buffer size, multiple of the scale */
+    int               height;
+    int               hotspot_x;  /* in buffer pixels */
+    int               hotspot_y;
+    DWORD             delay;      /* in ms */
+};
+
+struct wayland_cursor
+{
+    struct list         entry;    /* entry in the LRU cache, most recent first */
+    HCURSOR             handle;   /* 0 once the cursor has been destroyed */
+    int                 scale;
+    unsigned int        count;
+    struct cursor_frame frames[1];
+};
+
+#define MAX_CACHED_CURSORS 32
+
+static struct list cursor_cache = LIST_INIT( cursor_cache );
+static unsigned int cursor_cache_size;
+
+static BOOL cursor_set;                         /* SetCursor was called at least once */
+static struct wayland_cursor *current_cursor;   /* NULL for no cursor */
+static unsigned int current_frame;
+static DWORD current_frame_time;
+
+static struct wl_cursor_theme *cursor_theme;
+static struct wl_cursor *default_cursor;
+static INIT_ONCE theme_once = INIT_ONCE_STATIC_INIT;
+
+static CRITICAL_SECTION cursor_section;
+static CRITICAL_SECTION_DEBUG critsect_debug =
+{
+    0, 0, &cursor_section,
+    { &critsect_debug.ProcessLocksList, &critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": cursor_section") }
+};
+static CRITICAL_SECTION cursor_section = { &critsect_debug, -1, 0, 0, 0, 0 };
+
+
+/***********************************************************************
+ *		get_bitmap_argb
+ *
+ * Return the bitmap bits in ARGB format. Helper for converting icons and cursors.
+ */
+static unsigned int *get_bitmap_argb( HDC hdc, HBITMAP color, HBITMAP mask, unsigned int *width,
+                                      unsigned int *height )
+{
+    char buffer[FIELD_OFFSET( BITMAPINFO, bmiColors[256] )];
+    BITMAPINFO *info = (BITMAPINFO *)buffer;
+    BITMAP bm;
+    unsigned int *ptr, *bits = NULL;
+    unsigned char *mask_bits = NULL;
+    int i, j;
+    BOOL has_alpha = FALSE;
+
+    if (!GetObjectW( color, sizeof(bm), &bm )) return NULL;
+    info->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info->bmiHeader.biWidth = bm.bmWidth;
+    info->bmiHeader.biHeight = -bm.bmHeight;
+    info->bmiHeader.biPlanes = 1;
+    info->bmiHeader.biBitCount = 32;
+    info->bmiHeader.biCompression = BI_RGB;
+    info->bmiHeader.biSizeImage = bm.bmWidth * bm.bmHeight * 4;
+    info->bmiHeader.biXPelsPerMeter = 0;
+    info->bmiHeader.biYPelsPerMeter = 0;
+    info->bmiHeader.biClrUsed = 0;
+    info->bmiHeader.biClrImportant = 0;
+    if (!(bits = heap_alloc( info->bmiHeader.biSizeImage ))) goto failed;
+    if (!GetDIBits( hdc, color, 0, bm.bmHeight, bits, info, DIB_RGB_COLORS )) goto failed;
+
+    *width = bm.bmWidth;
+    *height = bm.bmHeight;
+
+    for (i = 0; i < bm.bmWidth * bm.bmHeight; i++)
+        if ((has_alpha = (bits[i] & 0xff000000) != 0)) break;
+
+    if (!has_alpha)
+    {
+        unsigned int width_bytes = (bm.bmWidth + 31) / 32 * 4;
+        /* generate alpha channel from the mask */
+        info->bmiHeader.biBitCount = 1;
+        info->bmiHeader.biSizeImage = width_bytes * bm.bmHeight;
+        if (!(mask_bits = heap_alloc( info->bmiHeader.biSizeImage ))) goto failed;
+        if (!GetDIBits( hdc, mask, 0, bm.bmHeight, mask_bits, info, DIB_RGB_COLORS )) goto failed;
+        ptr = bits;
+        for (i = 0; i < bm.bmHeight; i++)
+            for (j = 0; j < bm.bmWidth; j++, ptr++)
+                if (!((mask_bits[i * width_bytes + j / 8] << (j % 8)) & 0x80)) *ptr |= 0xff000000;
+                else *ptr = 0;
+        heap_free( mask_bits );
+    }
+    else
+    {
+        /* wl_shm buffers use premultiplied alpha */
+        for (i = 0, ptr = bits; i < bm.bmWidth * bm.bmHeight; i++, ptr++)
+        {
+            unsigned int alpha = *ptr >> 24;
+            *ptr = (alpha << 24) |
+                   ((((*ptr >> 16) & 0xff) * alpha / 255) << 16) |
+                   ((((*ptr >> 8) & 0xff) * alpha / 255) << 8) |
+                   ((*ptr & 0xff) * alpha / 255);
+        }
+    }
+
+    return bits;
+
+failed:
+    heap_free( bits );
+    heap_free( mask_bits );
+    *width = *height = 0;
+    return NULL;
+}
+
+/***********************************************************************
+ *		get_monochrome_argb
+ *
+ * Convert a monochrome cursor, made of an AND mask followed by a XOR mask.
+ */
+static unsigned int *get_monochrome_argb( HDC hdc, HBITMAP mask, unsigned int *width, unsigned int *height )
+{
+    char buffer[FIELD_OFFSET( BITMAPINFO, bmiColors[256] )];
+    BITMAPINFO *info = (BITMAPINFO *)buffer;
+    BITMAP bm;
+    unsigned int width_bytes, *ptr, *bits = NULL;
+    unsigned char *mask_bits = NULL;
+    int i, j, and, xor;
+
+    if (!GetObjectW( mask, sizeof(bm), &bm )) return NULL;
+    bm.bmHeight /= 2;
+    width_bytes = (bm.bmWidth + 31) / 32 * 4;
+
+    info->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info->bmiHeader.biWidth = bm.bmWidth;
+    info->bmiHeader.biHeight = -bm.bmHeight * 2;
+    info->bmiHeader.biPlanes = 1;
+    info->bmiHeader.biBitCount = 1;
+    info->bmiHeader.biCompression = BI_RGB;
+    info->bmiHeader.biSizeImage = width_bytes * bm.bmHeight * 2;
+    info->bmiHeader.biXPelsPerMeter = 0;
+    info->bmiHeader.biYPelsPerMeter = 0;
+    info->bmiHeader.biClrUsed = 0;
+    info->bmiHeader.biClrImportant = 0;
+    if (!(mask_bits = heap_alloc( info->bmiHeader.biSizeImage ))) goto failed;
+    if (!GetDIBits( hdc, mask, 0, bm.bmHeight * 2, mask_bits, info, DIB_RGB_COLORS )) goto failed;
+    if (!(bits = heap_alloc( bm.bmWidth * bm.bmHeight * 4 ))) goto failed;
+
+    ptr = bits;
+    for (i = 0; i < bm.bmHeight; i++)
+    {
+        for (j = 0; j < bm.bmWidth; j++, ptr++)
+        {
+            and = (mask_bits[i * width_bytes + j / 8] << (j % 8)) & 0x80;
+            xor = (mask_bits[(i + bm.bmHeight) * width_bytes + j / 8] << (j % 8)) & 0x80;
+            /* there is no way to invert the screen, show inverted pixels as black */
+            if (and && !xor) *ptr = 0;
+            else if (xor && !and) *ptr = 0xffffffff;
+            else *ptr = 0xff000000;
+        }
+    }
+    heap_free( mask_bits );
+
+    *width = bm.bmWidth;
+    *height = bm.bmHeight;
+    return bits;
+
+failed:
+    heap_free( bits );
+    heap_free( mask_bits );
+    return NULL;
+}
+
+/***********************************************************************
+ *		get_cursor_frame_argb
+ */
+static unsigned int *get_cursor_frame_argb( HDC hdc, HCURSOR handle, unsigned int *width,
+                                            unsigned int *height, POINT *hotspot )
+{
+    ICONINFOEXW info;
+    unsigned int *bits;
+
+    info.cbSize = sizeof(info);
+    if (!GetIconInfoExW( handle, &info )) return NULL;
+
+    if (info.hbmColor) bits = get_bitmap_argb( hdc, info.hbmColor, info.hbmMask, width, height );
+    else bits = get_monochrome_argb( hdc, info.hbmMask, width, height );
+
+    hotspot->x = info.xHotspot;
+    hotspot->y = info.yHotspot;
+    DeleteObject( info.hbmColor );
+    DeleteObject( info.hbmMask );
+    return bits;
+}
+
+static void free_cursor( struct wayland_cursor *cursor )
+{
+    unsigned int i;
+
+    for (i = 0; i < cursor->count; i++)
+        if (cursor->frames[i].buffer) wl_buffer_destroy( cursor->frames[i].buffer );
+    heap_free( cursor );
+}
+
+/***********************************************************************
+ *		create_cursor
+ *
+ * Convert all the frames of a cursor to wl_shm buffers, the pixels are
+ * copied once into a single memfd shared by all the frames.
+ */
+static struct wayland_cursor *create_cursor( HCURSOR handle, int scale )
+{
+    struct frame_bits
+    {
+        unsigned int *bits;
+        unsigned int  width;
+        unsigned int  height;
+    } *src;
+    struct wayland_cursor *cursor = NULL;
+    struct wl_shm_pool *pool;
+    unsigned int i, y, *dst;
+    DWORD delay, count, size = 0, offset = 0;
+    POINT hotspot;
+    HCURSOR frame;
+    void *data;
+    HDC hdc;
+    int fd;
+
+    if (!wayland_cursor_shm) return NULL;
+
+    if (!GetCursorFrameInfo( handle, 0, 0, &delay, &count ) || !count) count = 1;
+    if (!(src = heap_calloc( count, sizeof(*src) ))) return NULL;
+    if (!(cursor = heap_alloc_zero( FIELD_OFFSET( struct wayland_cursor, frames[count] ) ))) goto done;
+
+    cursor->handle = handle;
+    cursor->scale = scale;
+    cursor->count = count;
+
+    hdc = CreateCompatibleDC( 0 );
+    for (i = 0; i < cursor->count; i++)
+    {
+        struct cursor_frame *f = &cursor->frames[i];
+        DWORD steps;
+
+        if (!(frame = GetCursorFrameInfo( handle, 0, i, &delay, &steps ))) break;
+        if (!(src[i].bits = get_cursor_frame_argb( hdc, frame, &src[i].width, &src[i].height, &hotspot )))
+            break;
+
+        /* buffers have to be a multiple of the buffer scale, pad them */
+        f->width = (src[i].width + scale - 1) / scale * scale;
+        f->height = (src[i].height + scale - 1) / scale * scale;
+        f->hotspot_x = hotspot.x;
+        f->hotspot_y = hotspot.y;
+        f->delay = delay * 100 / 6;  /* jiffies to ms */
+        size += f->width * f->height * 4;
+    }
+    DeleteDC( hdc );
+
+    if (i < cursor->count)
+    {
+        WARN( "failed to convert frame %u of cursor %p\n", i, handle );
+        goto failed;
+    }
+
+    fd = memfd_create( "wine-cursor", MFD_CLOEXEC );
+    if (fd < 0 || ftruncate( fd, size ) < 0 ||
+        (data = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED)
+    {
+        ERR( "failed to allocate %u bytes for cursor %p\n", size, handle );
+        if (fd >= 0) close( fd );
+        goto failed;
+    }
+
+    pool = wl_shm_create_pool( wayland_cursor_shm, fd, size );
+    for (i = 0; i < cursor->count; i++)
+    {
+        struct cursor_frame *f = &cursor->frames[i];
+
+        dst = (unsigned int *)((char *)data + offset);
+        memset( dst, 0, f->width * f->height * 4 );
+        for (y = 0; y < src[i].height; y++)
+            memcpy( dst + y * f->width, src[i].bits + y * src[i].width, src[i].width * 4 );
+
+        f->buffer = wl_shm_pool_create_buffer( pool, offset, f->width, f->height, f->width * 4,
+                                               WL_SHM_FORMAT_ARGB8888 );
+        offset += f->width * f->height * 4;
+    }
+    wl_shm_pool_destroy( pool );
+    munmap( data, size );
+    close( fd );
+
+    TRACE( "created cursor %p scale %d with %u frames\n", handle, scale, cursor->count );
+    goto done;
+
+failed:
+    free_cursor( cursor );
+    cursor = NULL;
+done:
+    for (i = 0; i < count; i++) heap_free( src[i].bits );
+    heap_free( src );
+    return cursor;
+}
+
+/***********************************************************************
+ *		get_cursor
+ *
+ * Look up a cursor in the cache, converting it on a miss. The cache is
+ * kept in LRU order; must be called with the cursor_section held.
+ */
+static struct wayland_cursor *get_cursor( HCURSOR handle, int scale )
+{
+    struct wayland_cursor *cursor, *next;
+
+    LIST_FOR_EACH_ENTRY( cursor, &cursor_cache, struct wayland_cursor, entry )
+    {
+        if (cursor->handle != handle || cursor->scale != scale) continue;
+        list_remove( &cursor->entry );
+        list_add_head( &cursor_cache, &cursor->entry );
+        return cursor;
+    }
+
+    if (!(cursor = create_cursor( handle, scale ))) return NULL;
+    list_add_head( &cursor_cache, &cursor->entry );
+    cursor_cache_size++;
+
+    /* evict the least recently used cursors, the current one is always at the head */
+    LIST_FOR_EACH_ENTRY_SAFE_REV( cursor, next, &cursor_cache, struct wayland_cursor, entry )
+    {
+        if (cursor_cache_size <= MAX_CACHED_CURSORS) break;
+        if (cursor == current_cursor) continue;
+        TRACE( "evicting cursor %p scale %d\n", cursor->handle, cursor->scale );
+        list_remove( &cursor->entry );
+        cursor_cache_size--;
+        free_cursor( cursor );
+    }
+    return LIST_ENTRY( list_head( &cursor_cache ), struct wayland_cursor, entry );
+}
+
+static BOOL CALLBACK load_cursor_theme( INIT_ONCE *once, void *param, void **context )
+{
+    DWORD start = GetTickCount();
+
+    if (!wayland_cursor_shm) return TRUE;
+    if ((cursor_theme = wl_cursor_theme_load( NULL, 32, wayland_cursor_shm )))
+        default_cursor = wl_cursor_theme_get_cursor( cursor_theme, "left_ptr" );
+    if (!default_cursor) WARN( "no left_ptr cursor in the cursor theme\n" );
+    TRACE( "cursor theme loaded in %u ms\n", GetTickCount() - start );
+    return TRUE;
+}
+
+static DWORD CALLBACK cursor_theme_thread( void *arg )
+{
+    InitOnceExecuteOnce( &theme_once, load_cursor_theme, NULL, NULL );
+    return 0;
+}
+
+/***********************************************************************
+ *		wayland_load_cursor_theme_async
+ *
+ * Start loading the cursor theme in the background. Reading the theme
+ * from disk is slow and the arrow is not needed before the first pointer
+ * enter, users of the theme wait for the load to finish.
+ */
+void wayland_load_cursor_theme_async(void)
+{
+    HANDLE thread;
+
+    if ((thread = CreateThread( NULL, 0, cursor_theme_thread, NULL, 0, NULL )))
+        CloseHandle( thread );
+    /* otherwise the theme is loaded on first use */
+}
+
+static struct wl_cursor *get_default_cursor(void)
+{
+    InitOnceExecuteOnce( &theme_once, load_cursor_theme, NULL, NULL );
+    return default_cursor;
+}
+
+/* must be called with the cursor_section held */
+static void show_cursor_frame( struct wayland_cursor *cursor, unsigned int frame )
+{
+    struct wl_cursor_image *image;
+    struct cursor_frame *f;
+
+    if (!wayland_pointer || !wayland_cursor_surface) return;
+
+    if (global_hide_cursor || wayland_confine)
+    {
+        wl_pointer_set_cursor( wayland_pointer, wayland_serial_id, NULL, 0, 0 );
+        return;
+    }
+
+    if (!cursor)
+    {
+        if (cursor_set || !get_default_cursor())
+        {
+            wl_pointer_set_cursor( wayland_pointer, wayland_serial_id, NULL, 0, 0 );
+            return;
+        }
+        /* nothing set yet, use the theme arrow */
+        image = default_cursor->images[0];
+        wl_surface_set_buffer_scale( wayland_cursor_surface, 1 );
+        wl_pointer_set_cursor( wayland_pointer, wayland_serial_id, wayland_cursor_surface,
+                               image->hotspot_x, image->hotspot_y );
+        wl_surface_attach( wayland_cursor_surface, wl_cursor_image_get_buffer( image ), 0, 0 );
+        wl_surface_damage( wayland_cursor_surface, 0, 0, image->width, image->height );
+        wl_surface_commit( wayland_cursor_surface );
+        return;
+    }
+
+    f = &cursor->frames[frame];
+    wl_surface_set_buffer_scale( wayland_cursor_surface, cursor->scale );
+    wl_pointer_set_cursor( wayland_pointer, wayland_serial_id, wayland_cursor_surface,
+                           f->hotspot_x / cursor->scale, f->hotspot_y / cursor->scale );
+    wl_surface_attach( wayland_cursor_surface, f->buffer, 0, 0 );
+    wl_surface_damage( wayland_cursor_surface, 0, 0, f->width, f->height );
+    wl_surface_commit( wayland_cursor_surface );
+}
+
+/***********************************************************************
+ *		wayland_show_cursor
+ *
+ * Show the current cursor again, after a pointer enter or when the
+ * pointer is released.
+ */
+void wayland_show_cursor(void)
+{
+    EnterCriticalSection( &cursor_section );
+    show_cursor_frame( current_cursor, current_frame );
+    LeaveCriticalSection( &cursor_section );
+}
+
+/***********************************************************************
+ *		wayland_is_cursor_hidden
+ *
+ * Whether the application hid the cursor, or the user asked for it to be
+ * always hidden.
+ */
+BOOL wayland_is_cursor_hidden(void)
+{
+    BOOL ret;
+
+    EnterCriticalSection( &cursor_section );
+    ret = global_hide_cursor || (cursor_set && !current_cursor);
+    LeaveCriticalSection( &cursor_section );
+    return ret;
+}
+
+/***********************************************************************
+ *		wayland_update_cursor_animation
+ *
+ * Advance animated cursors, called from the event loop.
+ */
+void wayland_update_cursor_animation(void)
+{
+    DWORD now;
+
+    if (!current_cursor || current_cursor->count <= 1) return;
+
+    EnterCriticalSection( &cursor_section );
+    now = GetTickCount();
+    if (current_cursor && current_cursor->count > 1 &&
+        now - current_frame_time >= current_cursor->frames[current_frame].delay)
+    {
+        current_frame = (current_frame + 1) % current_cursor->count;
+        current_frame_time = now;
+        show_cursor_frame( current_cursor, current_frame );
+    }
+    LeaveCriticalSection( &cursor_section );
+}
+
+/***********************************************************************
+ *		SetCursor (WAYLANDDRV.@)
+ */
+void CDECL WAYLANDDRV_SetCursor( HCURSOR handle )
+{
+    struct wayland_cursor *cursor = NULL;
+    int scale = wayland_get_cursor_scale();
+
+    EnterCriticalSection( &cursor_section );
+
+    if (cursor_set && current_cursor && current_cursor->handle == handle && current_cursor->scale == scale)
+    {
+        LeaveCriticalSection( &cursor_section );
+        return;
+    }
+
+    if (handle && !(cursor = get_cursor( handle, scale )))
+        WARN( "failed to convert cursor %p\n", handle );
+
+    TRACE( "%p -> %p\n", handle, cursor );
+    cursor_set = TRUE;
+    current_cursor = cursor;
+    current_frame = 0;
+    current_frame_time = GetTickCount();
+    show_cursor_frame( current_cursor, current_frame );
+
+    LeaveCriticalSection( &cursor_section );
+}
+
+/***********************************************************************
+ *		DestroyCursorIcon (WAYLANDDRV.@)
+ */
+void CDECL WAYLANDDRV_DestroyCursorIcon( HCURSOR handle )
+{
+    struct wayland_cursor *cursor, *next;
+
+    EnterCriticalSection( &cursor_section );
+    LIST_FOR_EACH_ENTRY_SAFE( cursor, next, &cursor_cache, struct wayland_cursor, entry )
+    {
+        if (cursor->handle != handle) continue;
+        TRACE( "%p scale %d\n", handle, cursor->scale );
+        /* the current cursor buffers may still be in use, it goes away with the LRU */
+        if (cursor == current_cursor)
+        {
+            cursor->handle = 0;
+            continue;
+        }
+        list_remove( &cursor->entry );
+        cursor_cache_size--;
+        free_cursor( cursor );
+    }
+    LeaveCriticalSection( &cursor_section );
+}
@@ -0,0 +1,499 @@
+/*
+ * Wayland input recording and replay
+ *
+ * Copyright 2020 varmd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "windef.h"
+#include "winbase.h"
+
+#include "waylanddrv.h"
+#include "wine/debug.h"
+
+#include "relative-pointer-unstable-v1-client-protocol.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(waylanddrv);
+
+/* The file starts with a header followed by fixed size records in host
+ * byte order. The wl_pointer, wl_keyboard and relative pointer listeners
+ * are wrapped: when recording the wrappers log the events before passing
+ * them on, when replaying the recorded events are fed to the same
+ * listeners from a timer polled with the display fd, and the live events
+ * are dropped except the ones that only set up state (enter, leave,
+ * keymap and repeat info). The keymap is not recorded, replays use the
+ * layout of the running compositor. */
+
+#define RECORD_MAGIC    0x52495757  /* 'W','W','I','R' */
+#define RECORD_VERSION  1
+
+enum record_type
+{
+    RECORD_POINTER_ENTER,
+    RECORD_POINTER_LEAVE,
+    RECORD_POINTER_MOTION,
+    RECORD_POINTER_BUTTON,
+    RECORD_POINTER_AXIS,
+    RECORD_POINTER_FRAME,
+    RECORD_POINTER_AXIS_SOURCE,
+    RECORD_POINTER_AXIS_STOP,
+    RECORD_POINTER_AXIS_DISCRETE,
+    RECORD_POINTER_AXIS_VALUE120,
+    RECORD_KEYBOARD_ENTER,
+    RECORD_KEYBOARD_LEAVE,
+    RECORD_KEYBOARD_KEY,
+    RECORD_KEYBOARD_MODIFIERS,
+    RECORD_RELATIVE_MOTION,
+};
+
+struct record_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct input_record
+{
+    uint32_t delay;     /* microseconds since the previous record */
+    uint16_t type;      /* enum record_type */
+    uint16_t reserved;
+    int32_t  args[6];   /* event arguments, in protocol order */
+};
+
+static FILE *record_file;
+static FILE *replay_file;
+static int replay_fd = -1;
+static struct input_record replay_next;
+static unsigned int replay_count;
+static ULONGLONG replay_time;   /* microseconds spent in the listeners */
+static ULONGLONG record_last_time;  /* time the previous event was recorded */
+static ULONGLONG replay_last_time;  /* time the previous event was due for replay */
+static INIT_ONCE input_once = INIT_ONCE_STATIC_INIT;
+
+static struct wl_pointer *input_pointer;
+static const struct wl_pointer_listener *input_pointer_listener;
+static struct wl_keyboard *input_keyboard;
+static const struct wl_keyboard_listener *input_keyboard_listener;
+static struct zwp_relative_pointer_v1 *input_relative;
+static const struct zwp_relative_pointer_v1_listener *input_relative_listener;
+
+static ULONGLONG get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (ULONGLONG)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record_event( enum record_type type, int32_t a0, int32_t a1, int32_t a2,
+                          int32_t a3, int32_t a4, int32_t a5 )
+{
+    struct input_record rec;
+    ULONGLONG now = get_time_us();
+
+    rec.delay = min( now - record_last_time, 0xffffffff );
+    rec.type = type;
+    rec.reserved = 0;
+    rec.args[0] = a0;
+    rec.args[1] = a1;
+    rec.args[2] = a2;
+    rec.args[3] = a3;
+    rec.args[4] = a4;
+    rec.args[5] = a5;
+    record_last_time = now;
+
+    if (fwrite( &rec, sizeof(rec), 1, record_file ) != 1)
+    {
+        WARN( "failed to write to %s, recording stopped\n", debugstr_a(waylanddrv_config.input_record) );
+        fclose( record_file );
+        record_file = NULL;
+    }
+}
+
+static BOOL read_next_record(void)
+{
+    if (fread( &replay_next, sizeof(replay_next), 1, replay_file ) == 1) return TRUE;
+
+    TRACE( "replayed %u events, %s us in the input listeners\n",
+           replay_count, wine_dbgstr_longlong(replay_time) );
+    fclose( replay_file );
+    replay_file = NULL;
+    close( replay_fd );
+    replay_fd = -1;
+    return FALSE;
+}
+
+static void arm_replay_timer(void)
+{
+    struct itimerspec timer;
+    ULONGLONG due = replay_last_time + replay_next.delay;
+
+    memset( &timer, 0, sizeof(timer) );
+    timer.it_value.tv_sec = due / 1000000;
+    timer.it_value.tv_nsec = (due % 1000000) * 1000;
+    /* a zero value would disarm the timer */
+    if (!timer.it_value.tv_sec && !timer.it_value.tv_nsec) timer.it_value.tv_nsec = 1;
+    timerfd_settime( replay_fd, TFD_TIMER_ABSTIME, &timer, NULL );
+}
+
+static BOOL CALLBACK open_input_files( INIT_ONCE *once, void *param, void **context )
+{
+    struct record_header header;
+
+    record_last_time = replay_last_time = get_time_us();
+
+    if (waylanddrv_config.input_record[0])
+    {
+        if (!(record_file = fopen( waylanddrv_config.input_record, "wb" )))
+            WARN( "can't create %s\n", debugstr_a(waylanddrv_config.input_record) );
+        else
+        {
+            header.magic = RECORD_MAGIC;
+            header.version = RECORD_VERSION;
+            fwrite( &header, sizeof(header), 1, record_file );
+            TRACE( "recording input to %s\n", debugstr_a(waylanddrv_config.input_record) );
+        }
+    }
+
+    if (waylanddrv_config.input_replay[0])
+    {
+        if (!(replay_file = fopen( waylanddrv_config.input_replay, "rb" )))
+        {
+            WARN( "can't open %s\n", debugstr_a(waylanddrv_config.input_replay) );
+            return TRUE;
+        }
+        if (fread( &header, sizeof(header), 1, replay_file ) != 1 ||
+            header.magic != RECORD_MAGIC || header.version != RECORD_VERSION)
+        {
+            WARN( "%s is not an input recording\n", debugstr_a(waylanddrv_config.input_replay) );
+            fclose( replay_file );
+            replay_file = NULL;
+            return TRUE;
+        }
+        if ((replay_fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK )) == -1)
+        {
+            WARN( "failed to create the replay timer\n" );
+            fclose( replay_file );
+            replay_file = NULL;
+            return TRUE;
+        }
+        TRACE( "replaying input from %s\n", debugstr_a(waylanddrv_config.input_replay) );
+        if (read_next_record()) arm_replay_timer();
+    }
+    return TRUE;
+}
+
+static BOOL input_files_open(void)
+{
+    InitOnceExecuteOnce( &input_once, open_input_files, NULL, NULL );
+    return record_file || replay_file;
+}
+
+/* pointer */
+
+static void pointer_enter( void *data, struct wl_pointer *pointer, uint32_t serial,
+                           struct wl_surface *surface, wl_fixed_t sx, wl_fixed_t sy )
+{
+    if (record_file) record_event( RECORD_POINTER_ENTER, serial, sx, sy, 0, 0, 0 );
+    input_pointer_listener->enter( data, pointer, serial, surface, sx, sy );
+}
+
+static void pointer_leave( void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface )
+{
+    if (record_file) record_event( RECORD_POINTER_LEAVE, serial, 0, 0, 0, 0, 0 );
+    input_pointer_listener->leave( data, pointer, serial, surface );
+}
+
+static void pointer_motion( void *data, struct wl_pointer *pointer, uint32_t time, wl_fixed_t sx, wl_fixed_t sy )
+{
+    if (record_file) record_event( RECORD_POINTER_MOTION, time, sx, sy, 0, 0, 0 );
+    if (!replay_file) input_pointer_listener->motion( data, pointer, time, sx, sy );
+}
+
+static void pointer_button( void *data, struct wl_pointer *pointer, uint32_t serial, uint32_t time,
+                            uint32_t button, uint32_t state )
+{
+    if (record_file) record_event( RECORD_POINTER_BUTTON, serial, time, button, state, 0, 0 );
+    if (!replay_file) input_pointer_listener->button( data, pointer, serial, time, button, state );
+}
+
+static void pointer_axis( void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis, wl_fixed_t value )
+{
+    if (record_file) record_event( RECORD_POINTER_AXIS, time, axis, value, 0, 0, 0 );
+    if (!replay_file) input_pointer_listener->axis( data, pointer, time, axis, value );
+}
+
+static void pointer_frame( void *data, struct wl_pointer *pointer )
+{
+    if (record_file) record_event( RECORD_POINTER_FRAME, 0, 0, 0, 0, 0, 0 );
+    if (!replay_file) input_pointer_listener->frame( data, pointer );
+}
+
+static void pointer_axis_source( void *data, struct wl_pointer *pointer, uint32_t source )
+{
+    if (record_file) record_event( RECORD_POINTER_AXIS_SOURCE, source, 0, 0, 0, 0, 0 );
+    if (!replay_file) input_pointer_listener->axis_source( data, pointer, source );
+}
+
+static void pointer_axis_stop( void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis )
+{
+    if (record_file) record_event( RECORD_POINTER_AXIS_STOP, time, axis, 0, 0, 0, 0 );
+    if (!replay_file) input_pointer_listener->axis_stop( data, pointer, time, axis );
+}
+
+static void pointer_axis_discrete( void *data, struct wl_pointer *pointer, uint32_t axis, int32_t discrete )
+{
+    if (record_file) record_event( RECORD_POINTER_AXIS_DISCRETE, axis, discrete, 0, 0, 0, 0 );
+    if (!replay_file) input_pointer_listener->axis_discrete( data, pointer, axis, discrete );
+}
+
+#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
+static void pointer_axis_value120( void *data, struct wl_pointer *pointer, uint32_t axis, int32_t value120 )
+{
+    if (record_file) record_event( RECORD_POINTER_AXIS_VALUE120, axis, value120, 0, 0, 0, 0 );
+    if (!replay_file) input_pointer_listener->axis_value120( data, pointer, axis, value120 );
+}
+#endif
+
+static const struct wl_pointer_listener pointer_listener =
+{
+    pointer_enter,
+    pointer_leave,
+    pointer_motion,
+    pointer_button,
+    pointer_axis,
+    pointer_frame,
+    pointer_axis_source,
+    pointer_axis_stop,
+    pointer_axis_discrete,
+#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
+    pointer_axis_value120,
+#endif
+};
+
+/***********************************************************************
+ *		wayland_input_pointer_listener
+ *
+ * Return the listener to add to a wl_pointer, the driver listener itself
+ * unless input is recorded or replayed.
+ */
+const struct wl_pointer_listener *wayland_input_pointer_listener( struct wl_pointer *pointer,
+                                                                  const struct wl_pointer_listener *listener )
+{
+    input_pointer = pointer;
+    input_pointer_listener = listener;
+    return input_files_open() ? &pointer_listener : listener;
+}
+
+/* keyboard */
+
+static void keyboard_keymap( void *data, struct wl_keyboard *keyboard, uint32_t format, int fd, uint32_t size )
+{
+    input_keyboard_listener->keymap( data, keyboard, format, fd, size );
+}
+
+static void keyboard_enter( void *data, struct wl_keyboard *keyboard, uint32_t serial,
+                            struct wl_surface *surface, struct wl_array *keys )
+{
+    /* the pressed keys are synced from the live event, they aren't recorded */
+    if (record_file) record_event( RECORD_KEYBOARD_ENTER, serial, 0, 0, 0, 0, 0 );
+    input_keyboard_listener->enter( data, keyboard, serial, surface, keys );
+}
+
+static void keyboard_leave( void *data, struct wl_keyboard *keyboard, uint32_t serial, struct wl_surface *surface )
+{
+    if (record_file) record_event( RECORD_KEYBOARD_LEAVE, serial, 0, 0, 0, 0, 0 );
+    input_keyboard_listener->leave( data, keyboard, serial, surface );
+}
+
+static void keyboard_key( void *data, struct wl_keyboard *keyboard, uint32_t serial, uint32_t time,
+                          uint32_t key, uint32_t state )
+{
+    if (record_file) record_event( RECORD_KEYBOARD_KEY, serial, time, key, state, 0, 0 );
+    if (!replay_file) input_keyboard_listener->key( data, keyboard, serial, time, key, state );
+}
+
+static void keyboard_modifiers( void *data, struct wl_keyboard *keyboard, uint32_t serial, uint32_t depressed,
+                                uint32_t latched, uint32_t locked, uint32_t group )
+{
+    if (record_file) record_event( RECORD_KEYBOARD_MODIFIERS, serial, depressed, latched, locked, group, 0 );
+    if (!replay_file) input_keyboard_listener->modifiers( data, keyboard, serial, depressed, latched, locked, group );
+}
+
+static void keyboard_repeat_info( void *data, struct wl_keyboard *keyboard, int32_t rate, int32_t delay )
+{
+    input_keyboard_listener->repeat_info( data, keyboard, rate, delay );
+}
+
+static const struct wl_keyboard_listener keyboard_listener =
+{
+    keyboard_keymap,
+    keyboard_enter,
+    keyboard_leave,
+    keyboard_key,
+    keyboard_modifiers,
+    keyboard_repeat_info,
+};
+
+const struct wl_keyboard_listener *wayland_input_keyboard_listener( struct wl_keyboard *keyboard,
+                                                                    const struct wl_keyboard_listener *listener )
+{
+    input_keyboard = keyboard;
+    input_keyboard_listener = listener;
+    return input_files_open() ? &keyboard_listener : listener;
+}
+
+/* relative pointer */
+
+static void relative_motion( void *data, struct zwp_relative_pointer_v1 *pointer, uint32_t utime_hi,
+                             uint32_t utime_lo, wl_fixed_t dx, wl_fixed_t dy,
+                             wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel )
+{
+    if (record_file)
+        record_event( RECORD_RELATIVE_MOTION, utime_hi, utime_lo, dx, dy, dx_unaccel, dy_unaccel );
+    if (!replay_file)
+        input_relative_listener->relative_motion( data, pointer, utime_hi, utime_lo, dx, dy, dx_unaccel, dy_unaccel );
+}
+
+static const struct zwp_relative_pointer_v1_listener relative_listener =
+{
+    relative_motion,
+};
+
+const struct zwp_relative_pointer_v1_listener *wayland_input_relative_pointer_listener(
+        struct zwp_relative_pointer_v1 *pointer, const struct zwp_relative_pointer_v1_listener *listener )
+{
+    input_relative = pointer;
+    input_relative_listener = listener;
+    return input_files_open() ? &relative_listener : listener;
+}
+
+/***********************************************************************
+ *		wayland_input_relative_pointer_destroyed
+ *
+ * Called before the relative pointer is destroyed, when the pointer is
+ * unlocked. Replayed relative motion is dropped until the next one.
+ */
+void wayland_input_relative_pointer_destroyed( struct zwp_relative_pointer_v1 *pointer )
+{
+    if (input_relative == pointer) input_relative = NULL;
+}
+
+/***********************************************************************
+ *		wayland_input_record_flush
+ *
+ * Write the events recorded while dispatching, once per wakeup.
+ */
+void wayland_input_record_flush(void)
+{
+    if (record_file) fflush( record_file );
+}
+
+int wayland_input_replay_fd(void)
+{
+    return replay_fd;
+}
+
+static void replay_record( const struct input_record *rec )
+{
+    const int32_t *a = rec->args;
+    const struct wl_pointer_listener *pointer = input_pointer_listener;
+    const struct wl_keyboard_listener *keyboard = input_keyboard_listener;
+
+    switch (rec->type)
+    {
+    case RECORD_POINTER_ENTER:
+    case RECORD_POINTER_LEAVE:
+    case RECORD_KEYBOARD_ENTER:
+    case RECORD_KEYBOARD_LEAVE:
+        /* focus follows the live compositor */
+        break;
+    case RECORD_POINTER_MOTION:
+        if (pointer) pointer->motion( NULL, input_pointer, a[0], a[1], a[2] );
+        break;
+    case RECORD_POINTER_BUTTON:
+        if (pointer) pointer->button( NULL, input_pointer, a[0], a[1], a[2], a[3] );
+        break;
+    case RECORD_POINTER_AXIS:
+        if (pointer) pointer->axis( NULL, input_pointer, a[0], a[1], a[2] );
+        break;
+    case RECORD_POINTER_FRAME:
+        if (pointer) pointer->frame( NULL, input_pointer );
+        break;
+    case RECORD_POINTER_AXIS_SOURCE:
+        if (pointer) pointer->axis_source( NULL, input_pointer, a[0] );
+        break;
+    case RECORD_POINTER_AXIS_STOP:
+        if (pointer) pointer->axis_stop( NULL, input_pointer, a[0], a[1] );
+        break;
+    case RECORD_POINTER_AXIS_DISCRETE:
+        if (pointer) pointer->axis_discrete( NULL, input_pointer, a[0], a[1] );
+        break;
+#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
+    case RECORD_POINTER_AXIS_VALUE120:
+        if (pointer) pointer->axis_value120( NULL, input_pointer, a[0], a[1] );
+        break;
+#endif
+    case RECORD_KEYBOARD_KEY:
+        if (keyboard) keyboard->key( NULL, input_keyboard, a[0], a[1], a[2], a[3] );
+        break;
+    case RECORD_KEYBOARD_MODIFIERS:
+        if (keyboard) keyboard->modifiers( NULL, input_keyboard, a[0], a[1], a[2], a[3], a[4] );
+        break;
+    case RECORD_RELATIVE_MOTION:
+        /* only while the live pointer is locked, like the recorded one was */
+        if (input_relative && input_relative_listener)
+            input_relative_listener->relative_motion( NULL, input_relative, a[0], a[1], a[2], a[3], a[4], a[5] );
+        break;
+    default:
+        WARN( "unknown record type %u\n", rec->type );
+        break;
+    }
+}
+
+/***********************************************************************
+ *		wayland_input_replay_dispatch
+ *
+ * Feed the recorded events that are due to the listeners, called when
+ * the replay timer fd is readable.
+ */
+void wayland_input_replay_dispatch(void)
+{
+    ULONGLONG expirations, start, now = get_time_us();
+
+    read( replay_fd, &expirations, sizeof(expirations) );
+
+    while (replay_last_time + replay_next.delay <= now)
+    {
+        replay_last_time += replay_next.delay;
+        start = get_time_us();
+        replay_record( &replay_next );
+        replay_time += get_time_us() - start;
+        replay_count++;
+        if (!read_next_record()) return;
+    }
+    arm_replay_timer();
+}
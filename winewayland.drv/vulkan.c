@@ -24,11 +24,16 @@
 #include "config.h"
 #include "wine/port.h"
 
+#include <assert.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 
 #define NONAMELESSUNION
 #define OEMRESOURCE
@@ -52,8 +57,13 @@
 
 
 
-//latest version is 5 
-#define WINE_WAYLAND_SEAT_VERSION 1
+/* version 4 for wl_keyboard.repeat_info, 5 for pointer frames and axis
+ * sources, 8 for high resolution wheels when libwayland knows about them */
+#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
+#define WINE_WAYLAND_SEAT_VERSION 8
+#else
+#define WINE_WAYLAND_SEAT_VERSION 7
+#endif
 
 #include "wine/vulkan.h"
 #include "wine/vulkan_driver.h"
@@ -74,11 +84,14 @@ WINE_DEFAULT_DEBUG_CHANNEL(waylanddrv);
 #include <wayland-client.h>
 #include <wayland-cursor.h>
 #include <wayland-egl.h>
+#include <xkbcommon/xkbcommon.h>
 //#include <GLES2/gl2.h>
 #include <EGL/egl.h>
 #include <linux/input-event-codes.h>
 #include "pointer-constraints-unstable-v1-client-protocol.h"
 #include "relative-pointer-unstable-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
 
 
 unsigned int wayland_confine = 0;
@@ -801,6 +814,266 @@ static const char* vkey_to_name( UINT vkey )
 }
 
 
+/* The compositor keymap is compiled once per keymap event into flat tables,
+ * so that translating a key is a single lookup. Keys keep the scancode of
+ * their position on a US keyboard, the character keys get the vkey of the
+ * character they produce like on Windows, unless another key already has
+ * that vkey. The characters are looked up by scancode, since the vkeys of
+ * a layout don't always tell keys with the same character apart. */
+#define KEYMAP_SHIFT  0x1
+#define KEYMAP_ALTGR  0x2
+#define KEYMAP_CAPS   0x4
+#define KEYMAP_STATES 8
+
+struct keymap_tables
+{
+    WORD  keycode_vkey[ARRAY_SIZE(keycode_to_vkey)];
+    WORD  keycode_scan[ARRAY_SIZE(keycode_to_vkey)];
+    WORD  vkey_scan[256];
+    WORD  scan_vkey[0x200];
+    WCHAR scan_char[0x200][KEYMAP_STATES]; /* indexed by KEYMAP_* flags */
+    SHORT char_vkey[0x10000];             /* VkKeyScan result, -1 if no key produces the character */
+};
+
+static struct xkb_context *xkb_context;
+static struct xkb_keymap *xkb_keymap;
+static struct keymap_tables *keymap_tables;   /* NULL until the compositor sends a keymap */
+static xkb_layout_index_t keymap_group;       /* layout group the tables were built for */
+static xkb_mod_mask_t keymap_caps_mask, keymap_num_mask;
+
+static CRITICAL_SECTION keymap_section;
+static CRITICAL_SECTION_DEBUG keymap_critsect_debug =
+{
+    0, 0, &keymap_section,
+    { &keymap_critsect_debug.ProcessLocksList, &keymap_critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": keymap_section") }
+};
+static CRITICAL_SECTION keymap_section = { &keymap_critsect_debug, -1, 0, 0, 0, 0 };
+
+/* keys that get the vkey of their character, digits keep their vkey like on Windows */
+static BOOL is_char_key( UINT vkey )
+{
+    return (vkey >= 'A' && vkey <= 'Z') || (vkey >= VK_OEM_1 && vkey <= VK_OEM_3) ||
+           (vkey >= VK_OEM_4 && vkey <= VK_OEM_7);
+}
+
+/* vkey of a character in the current layout, 0 if the character has none */
+static UINT get_layout_vkey( uint32_t ch )
+{
+    if (ch <= ' ' || ch >= ARRAY_SIZE(char_vkey_map) || char_vkey_map[ch] == -1) return 0;
+    return char_vkey_map[ch] & 0xff;
+}
+
+static xkb_mod_mask_t get_keymap_mod_mask( struct xkb_keymap *keymap, const char *name )
+{
+    xkb_mod_index_t index = xkb_keymap_mod_get_index( keymap, name );
+
+    return index == XKB_MOD_INVALID ? 0 : 1u << index;
+}
+
+/***********************************************************************
+ *           create_keymap_tables
+ */
+static struct keymap_tables *create_keymap_tables( struct xkb_keymap *keymap, xkb_layout_index_t group )
+{
+    xkb_mod_mask_t shift = get_keymap_mod_mask( keymap, XKB_MOD_NAME_SHIFT );
+    xkb_mod_mask_t caps = get_keymap_mod_mask( keymap, XKB_MOD_NAME_CAPS );
+    xkb_mod_mask_t altgr = get_keymap_mod_mask( keymap, "Mod5" );  /* ISO_Level3_Shift */
+    xkb_mod_mask_t depressed;
+    struct keymap_tables *tables;
+    struct xkb_state *state;
+    UINT keycode, vkey, scan, mods;
+    BOOL taken[256] = { FALSE };
+    uint32_t ch;
+
+    if (!(tables = heap_alloc_zero( sizeof(*tables) ))) return NULL;
+    if (!(state = xkb_state_new( keymap )))
+    {
+        heap_free( tables );
+        return NULL;
+    }
+    memset( tables->char_vkey, 0xff, sizeof(tables->char_vkey) );
+
+    /* the other keys keep their vkey, the character keys get theirs from the
+     * layout when it is still free, else the one of their US position */
+    for (keycode = 0; keycode < ARRAY_SIZE(keycode_to_vkey); keycode++)
+    {
+        if (!(vkey = keycode_to_vkey[keycode]) || vkey >= ARRAY_SIZE(vkey_to_scancode)) continue;
+        tables->keycode_scan[keycode] = vkey_to_scancode[vkey];
+        if (is_char_key( vkey )) continue;
+        tables->keycode_vkey[keycode] = vkey;
+        taken[vkey] = TRUE;
+    }
+    xkb_state_update_mask( state, 0, 0, 0, 0, 0, group );
+    for (keycode = 0; keycode < ARRAY_SIZE(keycode_to_vkey); keycode++)
+    {
+        if (!(vkey = keycode_to_vkey[keycode]) || !is_char_key( vkey )) continue;
+        vkey = get_layout_vkey( xkb_state_key_get_utf32( state, keycode + 8 ));
+        if (!vkey || taken[vkey]) continue;
+        tables->keycode_vkey[keycode] = vkey;
+        taken[vkey] = TRUE;
+    }
+    for (keycode = 0; keycode < ARRAY_SIZE(keycode_to_vkey); keycode++)
+    {
+        if (!(vkey = keycode_to_vkey[keycode]) || !is_char_key( vkey )) continue;
+        if (tables->keycode_vkey[keycode]) continue;
+        if (taken[vkey])
+        {
+            /* the US vkey went to another key, use a free OEM one */
+            for (vkey = VK_OEM_1; vkey <= VK_OEM_102; vkey++)
+                if (vkey_to_scancode[vkey] && !taken[vkey]) break;
+            if (vkey > VK_OEM_102)
+            {
+                WARN( "no free vkey for keycode %u\n", keycode );
+                continue;
+            }
+        }
+        tables->keycode_vkey[keycode] = vkey;
+        taken[vkey] = TRUE;
+    }
+    for (keycode = 0; keycode < ARRAY_SIZE(keycode_to_vkey); keycode++)
+    {
+        if (!(vkey = tables->keycode_vkey[keycode])) continue;
+        scan = tables->keycode_scan[keycode];
+        if (!tables->vkey_scan[vkey]) tables->vkey_scan[vkey] = scan;
+        if (!tables->scan_vkey[scan & 0x1ff]) tables->scan_vkey[scan & 0x1ff] = vkey;
+    }
+
+    /* fewer modifiers first, VkKeyScan returns the simplest way to type a character */
+    for (mods = 0; mods < KEYMAP_STATES; mods++)
+    {
+        depressed = 0;
+        if (mods & KEYMAP_SHIFT) depressed |= shift;
+        if (mods & KEYMAP_ALTGR) depressed |= altgr;
+        xkb_state_update_mask( state, depressed, 0, (mods & KEYMAP_CAPS) ? caps : 0, 0, 0, group );
+
+        for (keycode = 0; keycode < ARRAY_SIZE(keycode_to_vkey); keycode++)
+        {
+            if (!(vkey = tables->keycode_vkey[keycode])) continue;
+            if (!(ch = xkb_state_key_get_utf32( state, keycode + 8 )) || ch > 0xffff) continue;
+            scan = tables->keycode_scan[keycode] & 0x1ff;
+            if (!tables->scan_char[scan][mods]) tables->scan_char[scan][mods] = ch;
+            if (!(mods & KEYMAP_CAPS) && tables->char_vkey[ch] == -1)
+                tables->char_vkey[ch] = vkey | ((mods & KEYMAP_SHIFT) ? 0x100 : 0) |
+                                        ((mods & KEYMAP_ALTGR) ? 0x600 : 0);
+        }
+    }
+
+    xkb_state_unref( state );
+    return tables;
+}
+
+/***********************************************************************
+ *           set_keymap
+ *
+ * Compile the keymap sent by the compositor and replace the tables.
+ */
+static void set_keymap( uint32_t format, int fd, uint32_t size )
+{
+    struct keymap_tables *tables = NULL, *old_tables;
+    struct xkb_keymap *keymap = NULL, *old_keymap;
+    char *map;
+
+    if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1)
+    {
+        WARN( "unsupported keymap format %u\n", format );
+        return;
+    }
+    if (!xkb_context && !(xkb_context = xkb_context_new( XKB_CONTEXT_NO_FLAGS )))
+    {
+        ERR( "failed to create the xkb context\n" );
+        return;
+    }
+    /* the fd must be mapped private since wl_keyboard version 7 */
+    if ((map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 )) == MAP_FAILED)
+    {
+        ERR( "failed to map the keymap: %s\n", strerror(errno) );
+        return;
+    }
+    /* size includes the terminating null */
+    keymap = xkb_keymap_new_from_buffer( xkb_context, map, strnlen( map, size ),
+                                         XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS );
+    munmap( map, size );
+    if (!keymap || !(tables = create_keymap_tables( keymap, 0 )))
+    {
+        ERR( "failed to compile the keymap\n" );
+        if (keymap) xkb_keymap_unref( keymap );
+        return;
+    }
+    TRACE( "keymap with %u layouts, first %s\n", xkb_keymap_num_layouts( keymap ),
+           debugstr_a(xkb_keymap_layout_get_name( keymap, 0 )) );
+
+    EnterCriticalSection( &keymap_section );
+    old_tables = keymap_tables;
+    old_keymap = xkb_keymap;
+    keymap_tables = tables;
+    xkb_keymap = keymap;
+    keymap_group = 0;
+    keymap_caps_mask = get_keymap_mod_mask( keymap, XKB_MOD_NAME_CAPS );
+    keymap_num_mask = get_keymap_mod_mask( keymap, XKB_MOD_NAME_NUM );
+    LeaveCriticalSection( &keymap_section );
+
+    heap_free( old_tables );
+    if (old_keymap) xkb_keymap_unref( old_keymap );
+}
+
+/* rebuild the tables when the compositor switches to another layout,
+ * only called from the wayland event handlers like set_keymap */
+static void set_keymap_group( xkb_layout_index_t group )
+{
+    struct keymap_tables *tables, *old_tables;
+
+    if (!xkb_keymap || group == keymap_group) return;
+    if (!(tables = create_keymap_tables( xkb_keymap, group ))) return;
+    TRACE( "switching to layout %u %s\n", group, debugstr_a(xkb_keymap_layout_get_name( xkb_keymap, group )) );
+
+    EnterCriticalSection( &keymap_section );
+    old_tables = keymap_tables;
+    keymap_tables = tables;
+    keymap_group = group;
+    LeaveCriticalSection( &keymap_section );
+    heap_free( old_tables );
+}
+
+/* translate an evdev keycode, with the US tables until there is a keymap.
+ * Returns FALSE for keys without a vkey. */
+static BOOL translate_keycode( uint32_t keycode, WORD *vkey, WORD *scan )
+{
+    if (keycode >= ARRAY_SIZE(keycode_to_vkey)) return FALSE;
+    EnterCriticalSection( &keymap_section );
+    if (keymap_tables)
+    {
+        *vkey = keymap_tables->keycode_vkey[keycode];
+        *scan = keymap_tables->keycode_scan[keycode];
+    }
+    else
+    {
+        *vkey = keycode_to_vkey[keycode];
+        *scan = *vkey < ARRAY_SIZE(vkey_to_scancode) ? vkey_to_scancode[*vkey] : 0;
+    }
+    LeaveCriticalSection( &keymap_section );
+    return *vkey != 0;
+}
+
+/* character of a key for a combination of KEYMAP_* flags, 0 if unknown. The
+ * key is looked up by scancode, or by vkey when the scancode doesn't match. */
+static WCHAR keymap_get_char( UINT vkey, UINT scan, UINT mods )
+{
+    WCHAR ret = 0;
+
+    if (vkey >= 256) return 0;
+    EnterCriticalSection( &keymap_section );
+    if (keymap_tables)
+    {
+        scan &= 0x1ff;
+        if (!scan || keymap_tables->scan_vkey[scan] != vkey) scan = keymap_tables->vkey_scan[vkey] & 0x1ff;
+        ret = keymap_tables->scan_char[scan][mods];
+    }
+    LeaveCriticalSection( &keymap_section );
+    return ret;
+}
+
+
 /***********************************************************************
  *           WAYLAND_ToUnicodeEx
  */
@@ -813,13 +1086,20 @@ INT CDECL WAYLANDDRV_ToUnicodeEx( UINT virt, UINT scan, const BYTE *state,
     WCHAR buffer[2];
     BOOL shift = state[VK_SHIFT] & 0x80;
     BOOL ctrl = state[VK_CONTROL] & 0x80;
+    BOOL altgr = ctrl && (state[VK_MENU] & 0x80);
     BOOL numlock = state[VK_NUMLOCK] & 0x01;
+    UINT mods = 0;
 
     buffer[0] = buffer[1] = 0;
 
     if (scan & 0x8000) return 0;  /* key up */
 
-    /* FIXME: hardcoded layout */
+    if (shift) mods |= KEYMAP_SHIFT;
+    if (altgr) mods |= KEYMAP_ALTGR;
+    if (state[VK_CAPITAL] & 0x01) mods |= KEYMAP_CAPS;
+    if ((!ctrl || altgr) && (buffer[0] = keymap_get_char( virt, scan, mods ))) goto done;
+
+    /* no keymap from the compositor, or no character for the key in it: use a US layout */
 
     if (!ctrl)
     {
@@ -892,6 +1172,7 @@ INT CDECL WAYLANDDRV_ToUnicodeEx( UINT virt, UINT scan, const BYTE *state,
         }
     }
 
+done:
     lstrcpynW( buf, buffer, size );
     TRACE( "returning %d / %s\n", strlenW( buffer ), debugstr_wn(buf, strlenW( buffer )));
     return strlenW( buffer );
@@ -928,12 +1209,19 @@ UINT CDECL WAYLANDDRV_MapVirtualKeyEx( UINT code, UINT maptype, HKL hkl )
             code = VK_LMENU;
             break;
         }
-        if (code < ( sizeof(vkey_to_scancode) / sizeof(vkey_to_scancode[0]) ) ) ret = vkey_to_scancode[code];
+        EnterCriticalSection( &keymap_section );
+        if (keymap_tables && code < ARRAY_SIZE(keymap_tables->vkey_scan) && keymap_tables->vkey_scan[code])
+            ret = keymap_tables->vkey_scan[code];
+        else if (code < ( sizeof(vkey_to_scancode) / sizeof(vkey_to_scancode[0]) ) ) ret = vkey_to_scancode[code];
+        LeaveCriticalSection( &keymap_section );
         break;
     case MAPVK_VSC_TO_VK:
     case MAPVK_VSC_TO_VK_EX:
         /* scancode to vkey */
-        ret = scancode_to_vkey( code );
+        EnterCriticalSection( &keymap_section );
+        if (keymap_tables && code < ARRAY_SIZE(keymap_tables->scan_vkey)) ret = keymap_tables->scan_vkey[code];
+        LeaveCriticalSection( &keymap_section );
+        if (!ret) ret = scancode_to_vkey( code );
         if (maptype == MAPVK_VSC_TO_VK)
             switch (ret)
             {
@@ -951,7 +1239,11 @@ UINT CDECL WAYLANDDRV_MapVirtualKeyEx( UINT code, UINT maptype, HKL hkl )
         break;
     case MAPVK_VK_TO_CHAR:
         
-        if ((code >= 0x30 && code <= 0x39) || (code >= 0x41 && code <= 0x5a))
+        if ((ret = keymap_get_char( code, 0, 0 )))
+        {
+            ret = toupperW( ret );
+        }
+        else if ((code >= 0x30 && code <= 0x39) || (code >= 0x41 && code <= 0x5a))
         {
             key = code;
             if (code >= 0x41)
@@ -1014,7 +1306,11 @@ SHORT CDECL WAYLANDDRV_VkKeyScanEx( WCHAR ch, HKL hkl )
     //TRACE("%s \n", debugstr_w(ch));
   
     SHORT ret = -1;
-    if (ch < sizeof(char_vkey_map) / sizeof(char_vkey_map[0])) ret = char_vkey_map[ch];
+
+    EnterCriticalSection( &keymap_section );
+    if (keymap_tables) ret = keymap_tables->char_vkey[ch];
+    LeaveCriticalSection( &keymap_section );
+    if (ret == -1 && ch < sizeof(char_vkey_map) / sizeof(char_vkey_map[0])) ret = char_vkey_map[ch];
     return ret;
 }
 
@@ -1180,29 +1476,6 @@ BOOL CDECL WAYLANDDRV_GetCursorPos(LPPOINT pos)
 }
 
 
-/***********************************************************************
- *		GetCursorPos (WAYLANDDRV.@)
- 
-
-BOOL CDECL WAYLANDDRV_SetCursorPos(LPPOINT pos)
-{
-    if(!global_sx) {
-      pos->x = 0;
-      pos->y = 0;
-      return TRUE;
-    }
-  
-  
-    pos->x = global_sx;
-    pos->y = global_sy;
-    
-    //TRACE( "pointer at %d \n", pos->x, pos->y );
-    
-    return TRUE;
-
-    
-}
-*/
 
 //End Wayland keyboard arrays and funcs
 
@@ -1338,17 +1611,18 @@ struct wine_vk_surface *global_wine_surface;
 
 static struct wl_shell *wayland_shell = NULL;
 static struct wl_seat *wayland_seat = NULL;
-static struct wl_pointer *wayland_pointer = NULL;
+struct wl_pointer *wayland_pointer = NULL;
 static struct wl_keyboard *wayland_keyboard = NULL;
 static struct zwp_pointer_constraints_v1 *pointer_constraints = NULL;
 static struct zwp_relative_pointer_manager_v1 *relative_pointer_manager = NULL;
+static struct wp_viewporter *wayland_viewporter = NULL;
+static struct wl_subcompositor *wayland_subcompositor = NULL;
+static struct wp_fractional_scale_manager_v1 *fractional_scale_manager = NULL;
 struct zwp_locked_pointer_v1 *locked_pointer = NULL;
 struct zwp_confined_pointer_v1 *confined_pointer = NULL;
 struct zwp_relative_pointer_v1 *relative_pointer;
 static EGLDisplay egl_display;
 
-struct wl_cursor_theme *wayland_cursor_theme;
-struct wl_cursor       *wayland_default_cursor;
 struct wl_surface *wayland_cursor_surface;
 uint32_t wayland_serial_id;
 struct wl_shm *wayland_cursor_shm;
@@ -1366,10 +1640,63 @@ struct wayland_window {
 	EGLSurface egl_surface;
 	HWND pointer_to_hwnd;
 	int test;
+	/* buffer size in physical pixels */
+	int width;
+	int height;
+	/* preferred buffer scale, in 1/120 units like wp_fractional_scale_v1 */
+	int scale;
+	/* surface size in logical pixels, covered by the opaque region */
+	int surface_width;
+	int surface_height;
+	struct wl_output *output;
+	struct wp_viewport *viewport;
+	struct wp_fractional_scale_v1 *fractional_scale;
+	BOOL fullscreen;
+	RECT windowed_rect;
+	/* GDI content while vulkan presents to the main surface */
+	struct wl_surface *gdi_surface;
+	struct wl_subsurface *gdi_subsurface;
+	BOOL gdi_mapped;
+	/* the main surface shows GDI content, its regions are set by the GDI flusher */
+	BOOL gdi_regions;
+	/* the swapchain images are blended by the compositor, nothing is opaque */
+	BOOL translucent;
 };
 
 struct wayland_window vulkan_window;
 
+/* integer buffer scale used for the cursor surface */
+int wayland_get_cursor_scale(void)
+{
+  return max(1, vulkan_window.scale / 120);
+}
+
+static void wayland_window_set_fullscreen (struct wayland_window *window, BOOL fullscreen);
+
+/* surface coordinates are in logical pixels, win32 sees physical ones */
+static inline int wayland_surface_to_screen(wl_fixed_t coord)
+{
+  int scale = vulkan_window.scale ? vulkan_window.scale : 120;
+  return (int)(wl_fixed_to_double(coord) * scale / 120);
+}
+
+static inline wl_fixed_t wayland_screen_to_surface(int coord)
+{
+  int scale = vulkan_window.scale ? vulkan_window.scale : 120;
+  return wl_fixed_from_double((double)coord * 120 / scale);
+}
+
+/* wayland can't move the pointer, SetCursorPos records the distance
+ * between the requested and the real position and the absolute motion
+ * is shifted by it until the pointer enters again or the cursor shows */
+static int warp_x, warp_y;
+
+/* a visible cursor is where the compositor draws it */
+static void drop_visible_warp(void)
+{
+  if ((warp_x || warp_y) && !wayland_is_cursor_hidden()) warp_x = warp_y = 0;
+}
+
 // listeners
 
 void wayland_pointer_enter_cb(void *data,
@@ -1378,6 +1705,9 @@ void wayland_pointer_enter_cb(void *data,
 {
   
   wayland_serial_id = serial;
+  warp_x = warp_y = 0;
+  /* the cursor is undefined until we set it for this serial */
+  wayland_show_cursor();
   
 }
 
@@ -1468,14 +1798,15 @@ void wayland_pointer_motion_cb_vulkan(void *data,
     
     if(wayland_confine) {
       global_input.u.mi.dwFlags     = MOUSEEVENTF_MOVE;
-      global_input.u.mi.dx = wl_fixed_to_int(sx) - global_sx;
-      global_input.u.mi.dy = wl_fixed_to_int(sy) - global_sy;
-      global_sx = wl_fixed_to_int(sx);
-      global_sy = wl_fixed_to_int(sy);
+      global_input.u.mi.dx = wayland_surface_to_screen(sx) - global_sx;
+      global_input.u.mi.dy = wayland_surface_to_screen(sy) - global_sy;
+      global_sx = wayland_surface_to_screen(sx);
+      global_sy = wayland_surface_to_screen(sy);
       
     } else {
-      global_input.u.mi.dx          = wl_fixed_to_int(sx);
-      global_input.u.mi.dy          = wl_fixed_to_int(sy);  
+      drop_visible_warp();
+      global_input.u.mi.dx          = wayland_surface_to_screen(sx) + warp_x;
+      global_input.u.mi.dy          = wayland_surface_to_screen(sy) + warp_y;  
       global_sx = global_input.u.mi.dx;
       global_sy = global_input.u.mi.dy;
     }
@@ -1531,8 +1862,9 @@ void wayland_pointer_motion_cb(void *data,
   
     
 
-      global_input.u.mi.dx          = wl_fixed_to_int(sx);
-      global_input.u.mi.dy          = wl_fixed_to_int(sy);  
+      drop_visible_warp();
+      global_input.u.mi.dx          = wayland_surface_to_screen(sx) + warp_x;
+      global_input.u.mi.dy          = wayland_surface_to_screen(sy) + warp_y;  
       global_sx = global_input.u.mi.dx;
       global_sy = global_input.u.mi.dy;
     
@@ -1696,6 +2028,39 @@ int global_hwnd_popup_mode = 0;
 
 //https://github.com/spurious/SDL-mirror/blob/23e7cf4466908423884ebf8e8a250691743b8739/src/video/windows/SDL_windowsevents.c
 
+/* map a linux button code to the MOUSEEVENTF_* flags and mouse data of
+ * the press or release, returns FALSE for buttons windows doesn't know */
+static BOOL get_button_input( uint32_t button, uint32_t state, DWORD *flags, DWORD *data )
+{
+    BOOL pressed = (state == WL_POINTER_BUTTON_STATE_PRESSED);
+
+    *data = 0;
+    switch (button)
+    {
+    case BTN_LEFT:
+        *flags |= pressed ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP;
+        return TRUE;
+    case BTN_MIDDLE:
+        *flags |= pressed ? MOUSEEVENTF_MIDDLEDOWN : MOUSEEVENTF_MIDDLEUP;
+        return TRUE;
+    case BTN_RIGHT:
+        *flags |= pressed ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_RIGHTUP;
+        return TRUE;
+    case BTN_SIDE:
+    case BTN_BACK:
+        *flags |= pressed ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP;
+        *data = XBUTTON1;
+        return TRUE;
+    case BTN_EXTRA:
+    case BTN_FORWARD:
+        *flags |= pressed ? MOUSEEVENTF_XDOWN : MOUSEEVENTF_XUP;
+        *data = XBUTTON2;
+        return TRUE;
+    }
+    TRACE( "ignoring button %#x\n", button );
+    return FALSE;
+}
+
 void wayland_pointer_button_cb_vulkan(void *data,
 		struct wl_pointer *pointer, uint32_t serial, uint32_t time, uint32_t button,
 		uint32_t state)
@@ -1725,40 +2090,7 @@ void wayland_pointer_button_cb_vulkan(void *data,
   
     
  
-  switch (button)
-	{
-	case BTN_LEFT:
-    if(state == WL_POINTER_BUTTON_STATE_PRESSED) {
-      input.u.mi.dwFlags  |= MOUSEEVENTF_LEFTDOWN;
-      
-    } else if(state == WL_POINTER_BUTTON_STATE_RELEASED) {
-      input.u.mi.dwFlags |= MOUSEEVENTF_LEFTUP;       
-      
-      
-    }
-		break;
-    
-	case BTN_MIDDLE:
-		if(state == WL_POINTER_BUTTON_STATE_PRESSED)
-      //input.u.mi.dwFlags     = MOUSEEVENTF_MIDDLEDOWN | MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_MOVE;
-      input.u.mi.dwFlags     |= MOUSEEVENTF_MIDDLEDOWN;
-    else if(state == WL_POINTER_BUTTON_STATE_RELEASED)
-      //input.u.mi.dwFlags     = MOUSEEVENTF_MIDDLEUP | MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_MOVE;
-      input.u.mi.dwFlags     |= MOUSEEVENTF_MIDDLEUP;
-		break;
-    
-	case BTN_RIGHT:
-    TRACE("Right Click \n");
-		if(state == WL_POINTER_BUTTON_STATE_PRESSED)
-      input.u.mi.dwFlags     |= MOUSEEVENTF_RIGHTDOWN;
-    else if(state == WL_POINTER_BUTTON_STATE_RELEASED)
-      input.u.mi.dwFlags     |= MOUSEEVENTF_RIGHTUP;
-		break;   
-    
-    
-	default:
-		break;
-	}
+  if (!get_button_input( button, state, &input.u.mi.dwFlags, &input.u.mi.mouseData )) return;
   
   SERVER_START_REQ( send_hardware_message )
     {
@@ -1768,7 +2100,7 @@ void wayland_pointer_button_cb_vulkan(void *data,
         
         req->input.mouse.x     = input.u.mi.dx;
         req->input.mouse.y     = input.u.mi.dy;
-        req->input.mouse.data  = 0;
+        req->input.mouse.data  = input.u.mi.mouseData;
         req->input.mouse.flags = input.u.mi.dwFlags;
             //req->input.mouse.time  = input.u.mi.time;
         req->input.mouse.time  = 0;
@@ -1813,41 +2145,7 @@ void wayland_pointer_button_cb(void *data,
     
   
   
-	switch (button)
-	{
-	case BTN_LEFT:
-    if(state == WL_POINTER_BUTTON_STATE_PRESSED) {
-      input.u.mi.dwFlags  |= MOUSEEVENTF_LEFTDOWN;      
-      //mouse_state = 1;
-    } else if(state == WL_POINTER_BUTTON_STATE_RELEASED) {
-      input.u.mi.dwFlags |= MOUSEEVENTF_LEFTUP;       
-      
-      
-      //TRACE("Motion Click x y %d %d \n", pt_old.x, pt_old.y);
-      //TRACE("Click Global Pos x y %d %d \n", global_sx, global_sy);
-      //input.u.mi.dwFlags     = MOUSEEVENTF_LEFTUP | MOUSEEVENTF_MOVE;
-      //mouse_state = 2;
-    }
-		break;
-    
-	case BTN_MIDDLE:
-		if(state == WL_POINTER_BUTTON_STATE_PRESSED)
-      input.u.mi.dwFlags     |= MOUSEEVENTF_MIDDLEDOWN;
-    else if(state == WL_POINTER_BUTTON_STATE_RELEASED)
-      input.u.mi.dwFlags     |= MOUSEEVENTF_MIDDLEUP;
-		break;
-    
-	case BTN_RIGHT:
-		if(state == WL_POINTER_BUTTON_STATE_PRESSED)
-      input.u.mi.dwFlags     |= MOUSEEVENTF_RIGHTDOWN;
-    else if(state == WL_POINTER_BUTTON_STATE_RELEASED)
-      input.u.mi.dwFlags     |= MOUSEEVENTF_RIGHTUP;
-		break;   
-    
-    
-	default:
-		break;
-	}
+  if (!get_button_input( button, state, &input.u.mi.dwFlags, &input.u.mi.mouseData )) return;
   
 
   
@@ -1950,7 +2248,7 @@ void wayland_pointer_button_cb(void *data,
         
             req->input.mouse.x     = input.u.mi.dx;
             req->input.mouse.y     = input.u.mi.dy;
-            req->input.mouse.data  = 0;
+            req->input.mouse.data  = input.u.mi.mouseData;
             req->input.mouse.flags = input.u.mi.dwFlags;
             req->input.mouse.time  = 0;
             req->input.mouse.info  = 0;
@@ -1976,75 +2274,130 @@ void wayland_pointer_button_cb(void *data,
   
 }
 
-static void wayland_pointer_frame_cb(void *data, struct wl_pointer *wl_pointer) {
-  //do nothing  
-  TRACE("Pointer frame  \n");
+/* wl_pointer axis events are accumulated until the frame event and then
+ * sent as one wheel message per axis. Amounts are kept in 1/256 of a
+ * WHEEL_DELTA so smooth sources don't lose their fractional part. */
+#define AXIS_FIXED_PER_NOTCH  wl_fixed_from_int(15)  /* axis value of one wheel click */
+
+struct pointer_axis
+{
+    wl_fixed_t value;       /* sum of the axis events of the frame */
+    int        value120;    /* sum of the discrete/value120 events of the frame */
+    BOOL       has_value120;
+    int        remainder;   /* unsent wheel amount, in 1/256 of WHEEL_DELTA */
+};
+
+static struct pointer_axis pointer_axes[2];
+static uint32_t pointer_axis_source = WL_POINTER_AXIS_SOURCE_WHEEL;
+
+static void send_wheel_input( uint32_t axis, int delta )
+{
+    DWORD flags = MOUSEEVENTF_WHEEL;
+
+    /* wayland scrolls down for positive values, windows up; both scroll
+     * right for positive horizontal values */
+    if (axis == WL_POINTER_AXIS_HORIZONTAL_SCROLL) flags = MOUSEEVENTF_HWHEEL;
+    else delta = -delta;
+
+    SERVER_START_REQ( send_hardware_message )
+    {
+        req->win               = wine_server_user_handle( global_vulkan_hwnd );
+        req->flags             = 0;
+        req->input.type        = INPUT_MOUSE;
+        req->input.mouse.x     = global_sx;
+        req->input.mouse.y     = global_sy;
+        req->input.mouse.data  = delta;
+        req->input.mouse.flags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE | flags;
+        if (wayland_confine)
+        {
+            req->input.mouse.flags = flags;
+            req->input.mouse.x     = 0;
+            req->input.mouse.y     = 0;
+        }
+        req->input.mouse.time  = 0;
+        req->input.mouse.info  = 0;
+        wine_server_call( req );
+    }
+    SERVER_END_REQ;
+}
+
+static void flush_pointer_axis( uint32_t axis )
+{
+    struct pointer_axis *state = &pointer_axes[axis];
+    int delta;
+
+    if (state->has_value120)
+    {
+        /* high resolution wheels, 120 units are one notch */
+        state->remainder += state->value120 * WHEEL_DELTA * 256 / 120;
+    }
+    else if (state->value)
+    {
+        if (pointer_axis_source == WL_POINTER_AXIS_SOURCE_WHEEL ||
+            pointer_axis_source == WL_POINTER_AXIS_SOURCE_WHEEL_TILT)
+        {
+            /* old compositors without discrete steps, one event is one notch */
+            state->remainder += state->value > 0 ? WHEEL_DELTA * 256 : -WHEEL_DELTA * 256;
+        }
+        else
+            state->remainder += (int)((INT64)state->value * WHEEL_DELTA * 256 / AXIS_FIXED_PER_NOTCH);
+    }
+    state->value = 0;
+    state->value120 = 0;
+    state->has_value120 = FALSE;
+
+    if (!(delta = state->remainder / 256)) return;
+    state->remainder -= delta * 256;
+    TRACE( "axis %u source %u delta %d\n", axis, pointer_axis_source, delta );
+    send_wheel_input( axis, delta );
 }
-static void wayland_pointer_axis_source_cb(void *data, struct wl_pointer *wl_pointer, uint32_t axis_source)	{
-  TRACE("Pointer axis source  \n");
-  //do nothing
+
+static void wayland_pointer_frame_cb(void *data, struct wl_pointer *wl_pointer)
+{
+    flush_pointer_axis( WL_POINTER_AXIS_VERTICAL_SCROLL );
+    flush_pointer_axis( WL_POINTER_AXIS_HORIZONTAL_SCROLL );
+    pointer_axis_source = WL_POINTER_AXIS_SOURCE_WHEEL;
 }
-static void wayland_pointer_axis_stop_cb(void *data, struct wl_pointer *wl_pointer, uint32_t time, uint32_t axis)	{
-  TRACE("Pointer axis stop  \n");
-  //do nothing
+
+static void wayland_pointer_axis_source_cb(void *data, struct wl_pointer *wl_pointer, uint32_t axis_source)
+{
+    pointer_axis_source = axis_source;
 }
 
+static void wayland_pointer_axis_stop_cb(void *data, struct wl_pointer *wl_pointer, uint32_t time, uint32_t axis)
+{
+    /* the finger was lifted, don't carry a partial step into the next scroll */
+    if (axis > WL_POINTER_AXIS_HORIZONTAL_SCROLL) return;
+    pointer_axes[axis].remainder = 0;
+}
 
-static void wayland_pointer_axis_discrete_cb(void *data, struct wl_pointer *wl_pointer, uint32_t axis, int32_t discrete) {
-  
-  global_axis_dir = discrete;
-  TRACE("Motion Wheel discrete %d \n", global_axis_dir);
-  TRACE("Motion Wheel discrete %d \n", discrete);
-  
-  
+static void wayland_pointer_axis_discrete_cb(void *data, struct wl_pointer *wl_pointer, uint32_t axis, int32_t discrete)
+{
+    if (axis > WL_POINTER_AXIS_HORIZONTAL_SCROLL) return;
+    pointer_axes[axis].value120 += discrete * 120;
+    pointer_axes[axis].has_value120 = TRUE;
 }
 
+#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
+static void wayland_pointer_axis_value120_cb(void *data, struct wl_pointer *wl_pointer, uint32_t axis, int32_t value120)
+{
+    if (axis > WL_POINTER_AXIS_HORIZONTAL_SCROLL) return;
+    pointer_axes[axis].value120 += value120;
+    pointer_axes[axis].has_value120 = TRUE;
+}
+#endif
 
 //Mouse wheel
-void wayland_pointer_axis_cb(void *data,
+static void wayland_pointer_axis_cb(void *data,
 		struct wl_pointer *pointer, uint32_t time, uint32_t axis,
 		wl_fixed_t value)
 {
-  
-  
-  SERVER_START_REQ( send_hardware_message )
-    {
-        req->win        = wine_server_user_handle( global_vulkan_hwnd );
-        req->flags      = 0;
-        req->input.type = INPUT_MOUSE;
-        
-            req->input.mouse.x     = global_sx;
-            req->input.mouse.y     = global_sy;
-      
-            //if(!global_axis_dir) {
-              //global_axis_dir = 1;
-            //}
-      
-            //instead of using discrete callback of wl_pointer just check if value is negative
-            
-            req->input.mouse.data  = value > 0 ? -WHEEL_DELTA : WHEEL_DELTA;
-            req->input.mouse.flags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_WHEEL;
-            
-            if(wayland_confine) {
-              req->input.mouse.flags = MOUSEEVENTF_WHEEL;
-              req->input.mouse.x     = 0;
-              req->input.mouse.y     = 0;
-            }
-            
-            //req->input.mouse.time  = input.u.mi.time;
-            req->input.mouse.time  = 0;
-            req->input.mouse.info  = 0;
-            
-            wine_server_call( req );
-      
-            TRACE("Motion Wheel %d \n", global_axis_dir);
-        
-    }
-  SERVER_END_REQ;
-  
-  
- 
-  
+  if (axis > WL_POINTER_AXIS_HORIZONTAL_SCROLL) return;
+  pointer_axes[axis].value += value;
+
+  /* before version 5 there are no frame events */
+  if (wl_pointer_get_version( pointer ) < WL_POINTER_FRAME_SINCE_VERSION)
+    flush_pointer_axis( axis );
 }
 
 
@@ -2114,155 +2467,362 @@ relative_pointer_handle_motion(void *data, struct zwp_relative_pointer_v1 *point
 static const struct zwp_relative_pointer_v1_listener relative_pointer_listener = {
 	relative_pointer_handle_motion,
 };
-//relative pointer for locked surface
 
+/* pointer constraints: a locked pointer only reports relative motion and
+ * sets wayland_confine, a confined pointer keeps the absolute motion and
+ * is limited to confine_rect, in screen coordinates (empty for the whole
+ * surface) */
+static RECT confine_rect;
+static POINT lock_hint;     /* last position hint sent to the locked pointer */
 
+static void release_pointer_constraint(void)
+{
+  POINT pt;
 
+  if (locked_pointer && GetCursorPos(&pt))
+  {
+    /* leave the visible cursor where the game moved its own, the hint is
+     * applied on the commit */
+    TRACE("unlocking pointer at %d,%d\n", pt.x, pt.y);
+    zwp_locked_pointer_v1_set_cursor_position_hint(locked_pointer, wayland_screen_to_surface(pt.x),
+                                                   wayland_screen_to_surface(pt.y));
+    wl_surface_commit(vulkan_window.surface);
+    global_sx = pt.x;
+    global_sy = pt.y;
+    warp_x = warp_y = 0;
+  }
+  if (locked_pointer) zwp_locked_pointer_v1_destroy(locked_pointer);
+  if (confined_pointer) zwp_confined_pointer_v1_destroy(confined_pointer);
+  if (relative_pointer) {
+    wayland_input_relative_pointer_destroyed(relative_pointer);
+    zwp_relative_pointer_v1_destroy(relative_pointer);
+  }
+  locked_pointer = NULL;
+  confined_pointer = NULL;
+  relative_pointer = NULL;
+  SetRectEmpty(&confine_rect);
 
-void wayland_keyboard_keymap_cb(void *data,
-		struct wl_keyboard *keyboard, uint32_t format, int fd, uint32_t size)
-{
-  
-  
+  if (wayland_confine)
+  {
+    wayland_confine = 0;
+    //show mouse if it's not hidden by env variable
+    wayland_show_cursor();
+  }
 }
 
-void wayland_keyboard_enter_cb(void *data,
-		struct wl_keyboard *keyboard, uint32_t serial,
-		struct wl_surface *surface, struct wl_array *keys)
+static void lock_pointer(uint32_t lifetime)
 {
+  if (locked_pointer) return;
+  release_pointer_constraint();
+
+  TRACE("locking pointer\n");
+  wayland_confine = 1;
+  locked_pointer = zwp_pointer_constraints_v1_lock_pointer(pointer_constraints, vulkan_window.surface,
+                                                           wayland_pointer, NULL, lifetime);
+  lock_hint.x = lock_hint.y = -1;
+  relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(relative_pointer_manager, wayland_pointer);
+  zwp_relative_pointer_v1_add_listener(relative_pointer,
+      wayland_input_relative_pointer_listener(relative_pointer, &relative_pointer_listener), NULL);
+  wl_surface_commit(vulkan_window.surface);
+
+  //hide mouse
+  wl_pointer_set_cursor(wayland_pointer, wayland_serial_id, NULL, 0, 0);
 }
 
-void wayland_keyboard_leave_cb(void *data,
-		struct wl_keyboard *keyboard, uint32_t serial,
-		struct wl_surface *surface)
+/* confine to a screen rectangle, NULL for the whole surface */
+static void confine_pointer(const RECT *rect)
 {
-}
-
-int wayland_full = 0;
-int global_mod_pressed = 0;
+  struct wl_region *region = NULL;
+  int scale = vulkan_window.scale ? vulkan_window.scale : 120;
+  RECT new_rect;
 
-/*
-static void test_keypress(HWND handle, WPARAM keycode, BYTE scancode, BOOL extended)
-{
-    LPARAM lp = 1 + (scancode << 16) + (extended ? KEYEVENTF_EXTENDEDKEY : 0);
+  if (rect) new_rect = *rect;
+  else SetRectEmpty(&new_rect);
+  if (confined_pointer && EqualRect(&new_rect, &confine_rect)) return;
 
-    SendMessageA(handle, WM_KEYDOWN, keycode, lp);
-    SendMessageA(handle, WM_KEYUP  , keycode, lp | 0xc000000);
-}
-*/
+  if (rect)
+  {
+    /* the region is in logical surface coordinates, rounded inwards */
+    int left = (rect->left * 120 + scale - 1) / scale, top = (rect->top * 120 + scale - 1) / scale;
+    int right = rect->right * 120 / scale, bottom = rect->bottom * 120 / scale;
 
+    region = wl_compositor_create_region(wayland_compositor);
+    wl_region_add(region, left, top, max(right - left, 1), max(bottom - top, 1));
+  }
 
-//https://stackoverflow.com/questions/8161741/handling-keyboard-input-in-win32-wm-char-or-wm-keydown-wm-keyup
-//https://stackoverflow.com/questions/44897991/wm-keydown-repeat-count
-void wayland_keyboard_key_cb (void *data, struct wl_keyboard *keyboard,
-		    uint32_t serial, uint32_t time, uint32_t keycode,
-		    uint32_t state)
+  TRACE("confining pointer to %s\n", wine_dbgstr_rect(&new_rect));
+  if (confined_pointer)
+  {
+    /* the new region applies on the next commit */
+    zwp_confined_pointer_v1_set_region(confined_pointer, region);
+  }
+  else
+  {
+    release_pointer_constraint();
+    confined_pointer = zwp_pointer_constraints_v1_confine_pointer(pointer_constraints, vulkan_window.surface,
+                                                                  wayland_pointer, region,
+                                                                  ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT);
+  }
+  confine_rect = new_rect;
+  if (region) wl_region_destroy(region);
+  wl_surface_commit(vulkan_window.surface);
+}
+//relative pointer for locked surface
+
+
+
+
+void wayland_keyboard_keymap_cb(void *data,
+		struct wl_keyboard *keyboard, uint32_t format, int fd, uint32_t size)
 {
-  INPUT input;
-  //int vkey;
-  HWND hwnd;
-  
-  
-  
-  if ((unsigned int)keycode >= sizeof(keycode_to_vkey)/sizeof(keycode_to_vkey[0]) || !keycode_to_vkey[keycode])
+  set_keymap(format, fd, size);
+  close(fd);
+}
+
+/* send a key event for an evdev keycode to the game or GDI window,
+ * returns FALSE for keys without a vkey */
+static BOOL send_key_input( uint32_t keycode, BOOL pressed )
+{
+  HWND hwnd = global_vulkan_hwnd ? global_vulkan_hwnd : global_update_hwnd;
+  WORD vkey, scan;
+
+  if (!translate_keycode(keycode, &vkey, &scan)) return FALSE;
+
+  SERVER_START_REQ( send_hardware_message )
+  {
+      req->win        = wine_server_user_handle( hwnd );
+      req->flags      = 0;
+      req->input.type = INPUT_KEYBOARD;
+
+      req->input.kbd.vkey  = vkey;
+      req->input.kbd.scan  = scan;
+      req->input.kbd.flags = ((scan & 0x100) ? KEYEVENTF_EXTENDEDKEY : 0) | (pressed ? 0 : KEYEVENTF_KEYUP);
+      req->input.kbd.time  = 0;
+      req->input.kbd.info  = 0;
+
+      wine_server_call( req );
+  }
+  SERVER_END_REQ;
+  return TRUE;
+}
+
+/* Key repeat is done on the client since wl_keyboard version 4. Repeats come
+ * from a periodic timerfd, polled with the display fd, so they don't drift;
+ * the server sets the previous key state bit of the repeated WM_KEYDOWN. */
+static int key_repeat_fd = -1;
+static int32_t key_repeat_rate;       /* per second, 0 disables repeat */
+static int32_t key_repeat_delay;      /* in ms */
+static uint32_t key_repeat_keycode;   /* repeating key, 0 if none */
+
+#define KEY_REPEAT_MAX_BURST 8        /* repeats sent at once after a stall */
+
+static void stop_key_repeat(void)
+{
+  struct itimerspec timer;
+
+  key_repeat_keycode = 0;
+  if (key_repeat_fd == -1) return;
+  memset(&timer, 0, sizeof(timer));
+  timerfd_settime(key_repeat_fd, 0, &timer, NULL);
+}
+
+static void start_key_repeat(uint32_t keycode)
+{
+  struct itimerspec timer;
+  long interval;
+
+  /* keys that don't repeat, like modifiers, leave the held key repeating */
+  if (xkb_keymap && !xkb_keymap_key_repeats(xkb_keymap, keycode + 8)) return;
+  stop_key_repeat();
+  if (key_repeat_rate <= 0) return;
+  if (key_repeat_fd == -1 &&
+      (key_repeat_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+    ERR("timerfd_create failed: %s\n", strerror(errno));
+    return;
+  }
+
+  interval = 1000000000L / key_repeat_rate;
+  timer.it_value.tv_sec = key_repeat_delay / 1000;
+  timer.it_value.tv_nsec = (key_repeat_delay % 1000) * 1000000L;
+  timer.it_interval.tv_sec = interval / 1000000000L;
+  timer.it_interval.tv_nsec = interval % 1000000000L;
+  /* a zero it_value would disarm the timer */
+  if (!timer.it_value.tv_sec && !timer.it_value.tv_nsec) timer.it_value.tv_nsec = 1;
+  if (timerfd_settime(key_repeat_fd, 0, &timer, NULL) == -1) return;
+  key_repeat_keycode = keycode;
+}
+
+static void dispatch_key_repeat(void)
+{
+  uint64_t count;
+
+  if (read(key_repeat_fd, &count, sizeof(count)) != sizeof(count)) return;
+  if (!key_repeat_keycode) return;
+  /* one WM_KEYDOWN for each period, but don't flood the queue after a stall */
+  if (count > KEY_REPEAT_MAX_BURST) count = KEY_REPEAT_MAX_BURST;
+  while (count--) send_key_input(key_repeat_keycode, TRUE);
+}
+
+void wayland_keyboard_repeat_info_cb(void *data, struct wl_keyboard *keyboard,
+		int32_t rate, int32_t delay)
+{
+  TRACE("rate %d delay %d\n", rate, delay);
+  key_repeat_rate = rate;
+  key_repeat_delay = max(0, delay);
+  if (rate <= 0) stop_key_repeat();
+}
+
+/***********************************************************************
+ *           read_wayland_events
+ *
+ * Wait for events on the display fd, after a successful
+ * wl_display_prepare_read, and run the key repeat timer meanwhile.
+ */
+static void read_wayland_events(void)
+{
+  struct pollfd fds[3];
+  int count = 1, repeat = -1, replay = -1;
+
+  fds[0].fd = wl_display_get_fd(wayland_display);
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  if (key_repeat_fd != -1) {
+    repeat = count++;
+    fds[repeat].fd = key_repeat_fd;
+    fds[repeat].events = POLLIN;
+    fds[repeat].revents = 0;
+  }
+  if (wayland_input_replay_fd() != -1) {
+    replay = count++;
+    fds[replay].fd = wayland_input_replay_fd();
+    fds[replay].events = POLLIN;
+    fds[replay].revents = 0;
+  }
+
+  while (poll(fds, count, -1) == -1 && errno == EINTR);
+
+  if (fds[0].revents) wl_display_read_events(wayland_display);
+  else wl_display_cancel_read(wayland_display);
+  wl_display_dispatch_pending(wayland_display);
+
+  if (replay != -1 && (fds[replay].revents & POLLIN)) wayland_input_replay_dispatch();
+  if (repeat != -1 && (fds[repeat].revents & POLLIN)) dispatch_key_repeat();
+  wayland_input_record_flush();
+}
+
+/* locked modifiers of the last wl_keyboard.modifiers event */
+static xkb_mod_mask_t keyboard_locked_mods;
+
+static void set_lock_state( BYTE *state, BOOL locked )
+{
+    if (locked) *state |= 0x01;
+    else *state &= ~0x01;
+}
+
+/***********************************************************************
+ *           sync_key_state
+ *
+ * Bring the async key state in line with the compositor in a single
+ * server request instead of sending an input event for each key. The
+ * lock keys are always synced. With reset, the keys in the keys array
+ * are pressed and all other keys are released.
+ */
+static void sync_key_state( BOOL reset, const uint32_t *keys, unsigned int count )
+{
+    BYTE keystate[256], prev[256];
+    xkb_mod_mask_t caps, num;
+    WORD vkey, scan;
+    unsigned int i;
+    BOOL ret;
+
+    SERVER_START_REQ( get_key_state )
     {
-        //TRACE( "keyboard_event: code %u unmapped key, ignoring \n",  keycode );
+        req->tid = 0;
+        req->key = -1;
+        wine_server_set_reply( req, keystate, sizeof(keystate) );
+        ret = !wine_server_call( req );
+    }
+    SERVER_END_REQ;
+    if (!ret) return;
+    memcpy( prev, keystate, sizeof(prev) );
 
+    if (reset)
+    {
+        for (i = 0; i < ARRAY_SIZE(keystate); i++)
+        {
+            /* buttons are not keys */
+            if (i == VK_LBUTTON || i == VK_RBUTTON || i == VK_MBUTTON ||
+                i == VK_XBUTTON1 || i == VK_XBUTTON2) continue;
+            keystate[i] &= ~0x80;
+        }
+        for (i = 0; i < count; i++)
+            if (translate_keycode( keys[i], &vkey, &scan )) keystate[vkey] |= 0x80;
+        keystate[VK_SHIFT] |= (keystate[VK_LSHIFT] | keystate[VK_RSHIFT]) & 0x80;
+        keystate[VK_CONTROL] |= (keystate[VK_LCONTROL] | keystate[VK_RCONTROL]) & 0x80;
+        keystate[VK_MENU] |= (keystate[VK_LMENU] | keystate[VK_RMENU]) & 0x80;
     }
-    
-    
-    /*
-    RECT rect;
-    SetRect( &rect, global_input.u.mi.dx, global_input.u.mi.dy,
-             global_input.u.mi.dx + 1, global_input.u.mi.dy + 1 );
-    MapWindowPoints( 0, global_update_hwnd, (POINT *)&rect, 2 );
 
-    SERVER_START_REQ( update_window_zorder )
+    EnterCriticalSection( &keymap_section );
+    caps = keymap_caps_mask;
+    num = keymap_num_mask;
+    LeaveCriticalSection( &keymap_section );
+    if (caps) set_lock_state( &keystate[VK_CAPITAL], keyboard_locked_mods & caps );
+    if (num) set_lock_state( &keystate[VK_NUMLOCK], keyboard_locked_mods & num );
+
+    if (!memcmp( keystate, prev, sizeof(keystate) )) return;
+    TRACE( "updating key state, %u keys pressed, locked mods %#x\n", reset ? count : 0, keyboard_locked_mods );
+
+    SERVER_START_REQ( set_key_state )
     {
-        req->window      = wine_server_user_handle( hwnd );
-        req->rect.left   = rect.left;
-        req->rect.top    = rect.top;
-        req->rect.right  = rect.right;
-        req->rect.bottom = rect.bottom;
+        req->tid = GetCurrentThreadId();
+        req->async = 1;
+        wine_server_add_data( req, keystate, sizeof(keystate) );
         wine_server_call( req );
     }
     SERVER_END_REQ;
-    
-    */
-    
-    input.type             = INPUT_KEYBOARD;
-    input.u.ki.wVk         = keycode_to_vkey[(unsigned int)keycode];
-    if(!input.u.ki.wVk) {
-      return;  
-    }
-    input.u.ki.wScan       = vkey_to_scancode[(int)input.u.ki.wVk];
-    input.u.ki.time        = 0;
-    input.u.ki.dwExtraInfo = 0;
-    input.u.ki.dwFlags     = (input.u.ki.wScan & 0x100) ? KEYEVENTF_EXTENDEDKEY : 0;
-    
-    
+}
 
-    
-    
-    /*
-    TRACE("keyboard_event: code %u vkey %x scan %x meta %x \n",
-                          keycode, input.u.ki.wVk, input.u.ki.wScan, state );
-    */
-    
-  input.type             = INPUT_KEYBOARD;
+void wayland_keyboard_enter_cb(void *data,
+		struct wl_keyboard *keyboard, uint32_t serial,
+		struct wl_surface *surface, struct wl_array *keys)
+{
+  /* keys pressed while another client had the focus */
+  sync_key_state(TRUE, keys->data, keys->size / sizeof(uint32_t));
+}
 
-  input.u.ki.time        = 0;
-  input.u.ki.dwExtraInfo = 0;
+void wayland_keyboard_leave_cb(void *data,
+		struct wl_keyboard *keyboard, uint32_t serial,
+		struct wl_surface *surface)
+{
+  /* the releases go to the next client, don't leave keys stuck (alt-tab) */
+  stop_key_repeat();
+  sync_key_state(TRUE, NULL, 0);
+}
 
-  hwnd = global_update_hwnd;  
-    
-  if(global_vulkan_hwnd) {
-    hwnd = global_vulkan_hwnd;
-  }
-  
-  
-  //TRACE("keyboard_event: hwnd %p \n", hwnd);
-  
-  /*
-  if(global_update_hwnd_sdl) {
-    
-    TRACE("keyboard_event: meta %x \n", state );
-    
-    if( keycode < 58 && keycode != 56 && keycode != 54 && keycode != 43 && keycode != 28 && keycode != 29 && keycode != 15 ) {   
-      input.u.ki.dwFlags |= KEYEVENTF_UNICODE;
-      input.u.ki.wVk = 0;
-    }
-       //SendMessageW(hwnd, WM_CHAR, keycode_to_vkey[(unsigned int)keycode], 1);
-  }
-  */
-  
-  if (state == WL_KEYBOARD_KEY_STATE_RELEASED) {
-    input.u.ki.dwFlags |= KEYEVENTF_KEYUP;
-  }
-  
-  
-  SERVER_START_REQ( send_hardware_message )
-    {
-        req->win        = wine_server_user_handle( hwnd );
-        req->flags      = 0;
-        req->input.type = input.type;
+int global_mod_pressed = 0;
 
-        req->input.kbd.vkey  = input.u.ki.wVk;
-        req->input.kbd.scan  = input.u.ki.wScan;
-        req->input.kbd.flags = input.u.ki.dwFlags;
-        req->input.kbd.time  = input.u.ki.time;
-        req->input.kbd.info  = input.u.ki.dwExtraInfo;
-            
-        wine_server_call( req );
+/*
+static void test_keypress(HWND handle, WPARAM keycode, BYTE scancode, BOOL extended)
+{
+    LPARAM lp = 1 + (scancode << 16) + (extended ? KEYEVENTF_EXTENDEDKEY : 0);
+
+    SendMessageA(handle, WM_KEYDOWN, keycode, lp);
+    SendMessageA(handle, WM_KEYUP  , keycode, lp | 0xc000000);
+}
+*/
+
+
+//https://stackoverflow.com/questions/8161741/handling-keyboard-input-in-win32-wm-char-or-wm-keydown-wm-keyup
+//https://stackoverflow.com/questions/44897991/wm-keydown-repeat-count
+void wayland_keyboard_key_cb (void *data, struct wl_keyboard *keyboard,
+		    uint32_t serial, uint32_t time, uint32_t keycode,
+		    uint32_t state)
+{
+  if (!send_key_input(keycode, state != WL_KEYBOARD_KEY_STATE_RELEASED)) return;
+
+  if (state != WL_KEYBOARD_KEY_STATE_RELEASED) start_key_repeat(keycode);
+  else if (keycode == key_repeat_keycode) stop_key_repeat();
 
-    }
-SERVER_END_REQ;
-  
-    
-    
-  
-  
-  
   if(state != WL_KEYBOARD_KEY_STATE_RELEASED) {
     return;
   }
@@ -2292,110 +2852,29 @@ SERVER_END_REQ;
                   SWP_NOACTIVATE | SWP_NOZORDER | SWP_NOSIZE);
     */
     
-    if(!wayland_full) {
-		  wl_shell_surface_set_fullscreen(vulkan_window.shell_surface,
-			  			WL_SHELL_SURFACE_FULLSCREEN_METHOD_DEFAULT,
-              0, NULL);
-      wayland_full = 1;
-    }
+    wayland_window_set_fullscreen(&vulkan_window, !vulkan_window.fullscreen);
     
     break;
     
-    case KEY_F10:
-      
-    
-      //SetCursor(NULL);
-
-    
-    if(!wayland_confine) {
-      
-      wayland_confine = 1;
-      
-      
-      locked_pointer = zwp_pointer_constraints_v1_confine_pointer( pointer_constraints,  vulkan_window.surface, wayland_pointer, NULL, ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT);
-      
-      
-      relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(relative_pointer_manager, wayland_pointer);
-      zwp_relative_pointer_v1_add_listener(relative_pointer, &relative_pointer_listener, NULL);
-      
-      
-      wl_surface_commit(vulkan_window.surface);
-      
-      struct wl_cursor_image *image;
-      struct wl_buffer *buffer;
-            
-            
-      //show/hide mouse
-      image = wayland_default_cursor->images[0];
-		  buffer = wl_cursor_image_get_buffer(image);
-      wl_pointer_set_cursor(wayland_pointer, wayland_serial_id,
-        wayland_cursor_surface,
-        image->hotspot_x,
-        image->hotspot_y);
-        wl_surface_attach(wayland_cursor_surface, buffer, 0, 0);
-        wl_surface_damage(wayland_cursor_surface, 0, 0,
-        image->width, image->height);
-       
-       wl_surface_commit(wayland_cursor_surface);
-       
-       wl_pointer_set_cursor(wayland_pointer, wayland_serial_id,
-        NULL, 0, 0);
-       wl_surface_commit(wayland_cursor_surface); 
-        
-      
-      
+    case KEY_F10: //confine pointer
       
+    if(locked_pointer || confined_pointer) {
+      release_pointer_constraint();
     } else {
-      
-      zwp_locked_pointer_v1_destroy(locked_pointer);
-	    zwp_relative_pointer_v1_destroy(relative_pointer);
-	    locked_pointer = NULL;
-	    relative_pointer = NULL;
-      
-      wayland_confine = 0;
+      confine_pointer(NULL);
     }
     
-    
     break;
     
     
     case KEY_F9: //lock pointer
       
-    
-      //SetCursor(NULL);
-
-    
-    if(!wayland_confine) {
-      
-      wayland_confine = 1;
-      
-      
-      confined_pointer = zwp_pointer_constraints_v1_lock_pointer( pointer_constraints,  vulkan_window.surface, wayland_pointer, NULL,ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_ONESHOT);
-
-      
-      
-      relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(relative_pointer_manager, wayland_pointer);
-      zwp_relative_pointer_v1_add_listener(relative_pointer, &relative_pointer_listener, NULL);
-      
-      wl_pointer_set_cursor(wayland_pointer, wayland_serial_id,
-        NULL, 0, 0);
-      
-      
-      wl_surface_commit(vulkan_window.surface);
-      
-      
-      
+    if(locked_pointer || confined_pointer) {
+      release_pointer_constraint();
     } else {
-      
-      zwp_locked_pointer_v1_destroy(confined_pointer);
-	    zwp_relative_pointer_v1_destroy(relative_pointer);
-	    locked_pointer = NULL;
-	    relative_pointer = NULL;
-      
-      wayland_confine = 0;
+      lock_pointer(ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_ONESHOT);
     }
     
-    
     break; //end F9
     
     default:
@@ -2411,10 +2890,117 @@ void wayland_keyboard_modifiers_cb(void *data,
 		struct wl_keyboard *keyboard, uint32_t serial, uint32_t mods_depressed,
 		uint32_t mods_latched, uint32_t mods_locked, uint32_t group)
 {
+  set_keymap_group(group);
+  /* pressed modifiers come as key events, only the lock state needs syncing */
+  if (mods_locked == keyboard_locked_mods) return;
+  keyboard_locked_mods = mods_locked;
+  sync_key_state(FALSE, NULL, 0);
+}
+
+
+
+
+static void seat_name_cb(void *data, struct wl_seat *seat, const char *name)
+{
+  TRACE("seat %s\n", debugstr_a(name));
+}
+
+/* wl_touch: the first contact drives the mouse like windows does for
+ * touch screens, the other contacts are ignored. Events are collected
+ * until wl_touch.frame so a frame costs at most one server request. */
+#define MI_WP_SIGNATURE  0xff515700  /* extra info of mouse input generated from touch */
+
+static struct wl_touch *wayland_touch = NULL;
+static struct
+{
+    int32_t  id;        /* contact driving the mouse, -1 if none */
+    BOOL     down;      /* the left button is pressed for it */
+    DWORD    flags;     /* MOUSEEVENTF_* flags of the current frame */
+    int      x, y;
+} touch_state = { -1 };
+
+static void wayland_touch_frame_cb(void *data, struct wl_touch *touch);
+
+static HWND get_touch_hwnd(void)
+{
+    if (waylanddrv_config.vulkan_only || global_is_vulkan) return global_vulkan_hwnd;
+    return global_update_hwnd;
+}
+
+static void wayland_touch_down_cb(void *data, struct wl_touch *touch, uint32_t serial, uint32_t time,
+                                  struct wl_surface *surface, int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+    if (touch_state.id != -1) return;
+    /* a new contact after a release in the same frame, send the release first */
+    if (touch_state.flags & MOUSEEVENTF_LEFTUP) wayland_touch_frame_cb( data, touch );
+    touch_state.id = id;
+    touch_state.down = TRUE;
+    touch_state.x = wayland_surface_to_screen( x );
+    touch_state.y = wayland_surface_to_screen( y );
+    touch_state.flags |= MOUSEEVENTF_MOVE | MOUSEEVENTF_LEFTDOWN;
+}
+
+static void wayland_touch_up_cb(void *data, struct wl_touch *touch, uint32_t serial, uint32_t time, int32_t id)
+{
+    if (id != touch_state.id) return;
+    touch_state.id = -1;
+    touch_state.down = FALSE;
+    touch_state.flags |= MOUSEEVENTF_LEFTUP;
 }
 
+static void wayland_touch_motion_cb(void *data, struct wl_touch *touch, uint32_t time,
+                                    int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+    if (id != touch_state.id) return;
+    touch_state.x = wayland_surface_to_screen( x );
+    touch_state.y = wayland_surface_to_screen( y );
+    touch_state.flags |= MOUSEEVENTF_MOVE;
+}
+
+static void wayland_touch_frame_cb(void *data, struct wl_touch *touch)
+{
+    if (!touch_state.flags) return;
+
+    /* the server generates the messages in flag order, so a tap that
+     * starts and ends in one frame still gives a down then an up */
+    SERVER_START_REQ( send_hardware_message )
+    {
+        req->win               = wine_server_user_handle( get_touch_hwnd() );
+        req->flags             = 0;
+        req->input.type        = INPUT_MOUSE;
+        req->input.mouse.x     = touch_state.x;
+        req->input.mouse.y     = touch_state.y;
+        req->input.mouse.data  = 0;
+        req->input.mouse.flags = touch_state.flags | MOUSEEVENTF_ABSOLUTE;
+        req->input.mouse.time  = 0;
+        req->input.mouse.info  = MI_WP_SIGNATURE;
+        wine_server_call( req );
+    }
+    SERVER_END_REQ;
+
+    TRACE( "touch %d,%d flags %#x\n", touch_state.x, touch_state.y, touch_state.flags );
+    global_sx = touch_state.x;
+    global_sy = touch_state.y;
+    touch_state.flags = 0;
+}
+
+static void wayland_touch_cancel_cb(void *data, struct wl_touch *touch)
+{
+    /* the compositor took over the touch sequence, release the button */
+    if (touch_state.down) touch_state.flags |= MOUSEEVENTF_LEFTUP;
+    touch_state.id = -1;
+    touch_state.down = FALSE;
+    wayland_touch_frame_cb( data, touch );
+}
 
+static void wayland_touch_shape_cb(void *data, struct wl_touch *touch, int32_t id,
+                                   wl_fixed_t major, wl_fixed_t minor)
+{
+}
 
+static void wayland_touch_orientation_cb(void *data, struct wl_touch *touch, int32_t id, wl_fixed_t orientation)
+{
+}
 
 static void seat_caps_cb(void *data, struct wl_seat *seat, enum wl_seat_capability caps)
 {
@@ -2422,10 +3008,9 @@ static void seat_caps_cb(void *data, struct wl_seat *seat, enum wl_seat_capabili
 	{
     
     wayland_pointer = wl_seat_get_pointer(seat);
-    char *is_vulkan = getenv( "WINE_VK_VULKAN_ONLY" );
     
     
-    if(!is_vulkan && !global_is_vulkan) {
+    if(!waylanddrv_config.vulkan_only && !global_is_vulkan) {
       
       static const struct wl_pointer_listener pointer_listener =
       {   wayland_pointer_enter_cb, 
@@ -2437,16 +3022,17 @@ static void seat_caps_cb(void *data, struct wl_seat *seat, enum wl_seat_capabili
           wayland_pointer_axis_source_cb,
           wayland_pointer_axis_stop_cb,
           wayland_pointer_axis_discrete_cb,
+#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
+          wayland_pointer_axis_value120_cb,
+#endif
       };
-      wl_pointer_add_listener(wayland_pointer, &pointer_listener, NULL);
+      wl_pointer_add_listener(wayland_pointer, wayland_input_pointer_listener(wayland_pointer, &pointer_listener), NULL);
     } else {
       
       TRACE("is vulkan 1 \n");
       
       //Some games want to use their cursor
-      char *env_hide_cursor = getenv( "WINE_VK_HIDE_CURSOR" );
-      
-      if(env_hide_cursor) {
+      if(waylanddrv_config.hide_cursor) {
         global_hide_cursor = 1;  
       }
       
@@ -2460,8 +3046,11 @@ static void seat_caps_cb(void *data, struct wl_seat *seat, enum wl_seat_capabili
           wayland_pointer_axis_source_cb,
           wayland_pointer_axis_stop_cb,
           wayland_pointer_axis_discrete_cb,
+#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
+          wayland_pointer_axis_value120_cb,
+#endif
       };
-      wl_pointer_add_listener(wayland_pointer, &pointer_listener, NULL);
+      wl_pointer_add_listener(wayland_pointer, wayland_input_pointer_listener(wayland_pointer, &pointer_listener), NULL);
     }
 		
 	}
@@ -2479,15 +3068,39 @@ static void seat_caps_cb(void *data, struct wl_seat *seat, enum wl_seat_capabili
         wayland_keyboard_enter_cb, 
         wayland_keyboard_leave_cb, 
         wayland_keyboard_key_cb,
-				wayland_keyboard_modifiers_cb, };
+				wayland_keyboard_modifiers_cb,
+        wayland_keyboard_repeat_info_cb, };
         
-		wl_keyboard_add_listener(wayland_keyboard, &keyboard_listener, NULL);
+		wl_keyboard_add_listener(wayland_keyboard, wayland_input_keyboard_listener(wayland_keyboard, &keyboard_listener), NULL);
 	}
 	else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && wayland_keyboard)
 	{
 		wl_keyboard_destroy(wayland_keyboard);
 		wayland_keyboard = NULL;
 	}
+
+	if ((caps & WL_SEAT_CAPABILITY_TOUCH) && !wayland_touch)
+	{
+		static const struct wl_touch_listener touch_listener =
+		{   wayland_touch_down_cb,
+        wayland_touch_up_cb,
+        wayland_touch_motion_cb,
+        wayland_touch_frame_cb,
+        wayland_touch_cancel_cb,
+        wayland_touch_shape_cb,
+        wayland_touch_orientation_cb, };
+
+		wayland_touch = wl_seat_get_touch(seat);
+		wl_touch_add_listener(wayland_touch, &touch_listener, NULL);
+	}
+	else if (!(caps & WL_SEAT_CAPABILITY_TOUCH) && wayland_touch)
+	{
+		wl_touch_destroy(wayland_touch);
+		wayland_touch = NULL;
+		touch_state.id = -1;
+		touch_state.down = FALSE;
+		touch_state.flags = 0;
+	}
 }
 
 void shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
@@ -2501,16 +3114,17 @@ struct wl_shm_listener shm_listener = {
 
 static void registry_add_object (void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version) {
 	if (!strcmp(interface,"wl_compositor")) {
-		wayland_compositor = wl_registry_bind (registry, name, &wl_compositor_interface, 1);
+		/* version 3 for wl_surface.set_buffer_scale */
+		wayland_compositor = wl_registry_bind (registry, name, &wl_compositor_interface, min(version, 4));
 	}
 	else if (!strcmp(interface,"wl_shell")) {
 		wayland_shell = wl_registry_bind (registry, name, &wl_shell_interface, 1);
 	} else if (!strcmp(interface, "wl_seat"))
 	{
-		wayland_seat = (struct wl_seat *) wl_registry_bind(registry, name, &wl_seat_interface, WINE_WAYLAND_SEAT_VERSION);
+		wayland_seat = (struct wl_seat *) wl_registry_bind(registry, name, &wl_seat_interface, min(version, WINE_WAYLAND_SEAT_VERSION));
 
 		static const struct wl_seat_listener seat_listener =
-		{ seat_caps_cb, };
+		{ seat_caps_cb, seat_name_cb, };
 		wl_seat_add_listener(wayland_seat, &seat_listener, data);
 	} else if (strcmp(interface, "zwp_pointer_constraints_v1") == 0) {
       pointer_constraints = wl_registry_bind(registry, name,
@@ -2520,32 +3134,84 @@ static void registry_add_object (void *data, struct wl_registry *registry, uint3
 		  relative_pointer_manager = wl_registry_bind(registry, name, &zwp_relative_pointer_manager_v1_interface, 1);
     } else if (strcmp(interface, "wl_shm") == 0) {
 		  wayland_cursor_shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
-		  wayland_cursor_theme = wl_cursor_theme_load(NULL, 32, wayland_cursor_shm);
-		  wayland_default_cursor = 	wl_cursor_theme_get_cursor(wayland_cursor_theme, "left_ptr");
-      wayland_cursor_surface = wl_compositor_create_surface(wayland_compositor);
       
       shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
       wl_shm_add_listener(shm, &shm_listener, NULL);
       
+    } else if (strcmp(interface, "wl_output") == 0) {
+      wayland_output_add(registry, name, version);
+    } else if (strcmp(interface, "wl_subcompositor") == 0) {
+      wayland_subcompositor = wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
+    } else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0) {
+      wayland_dmabuf_init(registry, name, version);
+    } else if (strcmp(interface, "wp_viewporter") == 0) {
+      wayland_viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    } else if (strcmp(interface, "wp_fractional_scale_manager_v1") == 0) {
+      fractional_scale_manager = wl_registry_bind(registry, name, &wp_fractional_scale_manager_v1_interface, 1);
     }
 }
 
 static void registry_remove_object (void *data, struct wl_registry *registry, uint32_t name) {
-	
+  if (wayland_output_remove(name)) return;
+  TRACE("global %u removed\n", name);
 }
 static struct wl_registry_listener registry_listener = {&registry_add_object, &registry_remove_object};
 
-static void shell_surface_ping (void *data, struct wl_shell_surface *shell_surface, uint32_t serial) {
-	wl_shell_surface_pong (shell_surface, serial);
-}
+/* connect to the compositor and bind the globals, once per process */
+static BOOL wayland_connect_display(void) {
+  struct wl_registry *registry;
+  DWORD start, time;
+
+  if (wayland_display) return TRUE;
+
+  start = GetTickCount();
+  desktop_tid = GetCurrentThreadId();
+  wayland_display = wl_display_connect (NULL);
+  if (!wayland_display) {
+    ERR("Failed to connect to the wayland display\n");
+    return FALSE;
+  }
+  registry = wl_display_get_registry (wayland_display);
+  wl_registry_add_listener (registry, &registry_listener, NULL);
+  wl_display_roundtrip (wayland_display);
+  time = GetTickCount();
+  TRACE("connect and registry roundtrip took %u ms\n", time - start);
+
+  /* the theme is only needed once the pointer enters a surface, so load
+   * it while we wait for the outputs and initialize EGL */
+  if (wayland_compositor)
+    wayland_cursor_surface = wl_compositor_create_surface(wayland_compositor);
+  wayland_load_cursor_theme_async();
+
+  /* second roundtrip for the events of the globals bound above, outputs included */
+  wl_display_roundtrip (wayland_display);
+  wayland_outputs_ready();
+  TRACE("output roundtrip took %u ms\n", GetTickCount() - time);
+  time = GetTickCount();
+
+  egl_display = eglGetDisplay (wayland_display);
+  eglInitialize (egl_display, NULL, NULL);
+  TRACE("EGL initialization took %u ms, %u ms total\n", GetTickCount() - time, GetTickCount() - start);
+  return TRUE;
+}
+
+static void shell_surface_ping (void *data, struct wl_shell_surface *shell_surface, uint32_t serial) {
+	wl_shell_surface_pong (shell_surface, serial);
+}
 static void shell_surface_configure (void *data, struct wl_shell_surface *shell_surface, uint32_t edges, int32_t width, int32_t height) {
-	//struct wayland_window *window = data;
-	//wl_egl_window_resize (window->egl_window, width, height, 0, 0);
-  //if(global_vulkan_hwnd) {
-    //TRACE("Changing sizes width height %d %d \n", width, height);
-    //SetWindowPos( global_vulkan_hwnd, HWND_TOP, 0, 0, width, height,
-    //              SWP_NOACTIVATE | SWP_NOZORDER);      
-  //}  
+	struct wayland_window *window = data;
+	int scale = window->scale ? window->scale : 120;
+
+	if (!width || !height || !window->fullscreen) return;
+
+	/* resize the game to the output, the swapchain then follows with
+	 * buffers that match the output mode */
+	width = width * scale / 120;
+	height = height * scale / 120;
+	TRACE("Changing sizes width height %d %d \n", width, height);
+	if (global_vulkan_hwnd)
+		SetWindowPos( global_vulkan_hwnd, HWND_TOP, 0, 0, width, height,
+		              SWP_NOACTIVATE | SWP_NOZORDER | SWP_ASYNCWINDOWPOS );
 }
 static void shell_surface_popup_done (void *data, struct wl_shell_surface *shell_surface) {
 	
@@ -2553,6 +3219,219 @@ static void shell_surface_popup_done (void *data, struct wl_shell_surface *shell
 
 static struct wl_shell_surface_listener shell_surface_listener = {&shell_surface_ping, &shell_surface_configure, &shell_surface_popup_done};
 
+/***********************************************************************
+ *		wayland_window_check_scanout
+ *
+ * Debug query, report whether the game surface can be put on a hardware
+ * plane by the compositor instead of being composited.
+ */
+static BOOL wayland_window_check_scanout (struct wayland_window *window) {
+  int width, height;
+  BOOL ret = TRUE;
+
+  if (!window->surface) return FALSE;
+
+  if (!window->fullscreen) {
+    TRACE("not fullscreen\n");
+    ret = FALSE;
+  }
+  if (!window->output || !wayland_output_get_mode(window->output, &width, &height)) {
+    TRACE("surface is not on a known output\n");
+    ret = FALSE;
+  } else if (window->width != width || window->height != height) {
+    TRACE("buffer %dx%d does not match the output mode %dx%d\n", window->width, window->height, width, height);
+    ret = FALSE;
+  }
+  if (window->surface_width * window->scale != window->width * 120 ||
+      window->surface_height * window->scale != window->height * 120) {
+    TRACE("surface %dx%d is resampled from buffer %dx%d\n", window->surface_width, window->surface_height,
+          window->width, window->height);
+    ret = FALSE;
+  }
+  if (window->gdi_mapped) {
+    TRACE("GDI overlay is mapped\n");
+    ret = FALSE;
+  }
+
+  TRACE("surface %p is %seligible for direct scanout\n", window->surface, ret ? "" : "not ");
+  return ret;
+}
+
+static void invalidate_gdi_regions(void);
+
+/* make the compositor show the buffer 1:1 on the output, instead of resampling
+ * it, and keep the opaque region in sync with the surface size and alpha */
+static void wayland_window_update_geometry (struct wayland_window *window) {
+  struct wl_region *region;
+  int width, height;
+
+  if (!window->surface || !window->width || !window->height) return;
+
+  width = window->width;
+  height = window->height;
+  if (window->viewport) {
+    /* surface size is rounded halfway away from zero */
+    width = max(1, (window->width * 120 + window->scale / 2) / window->scale);
+    height = max(1, (window->height * 120 + window->scale / 2) / window->scale);
+    wp_viewport_set_destination(window->viewport, width, height);
+    TRACE("buffer %dx%d scale %d/120 surface %dx%d\n", window->width, window->height,
+          window->scale, width, height);
+  } else if (wl_proxy_get_version((struct wl_proxy *)window->surface) >= WL_SURFACE_SET_BUFFER_SCALE_SINCE_VERSION) {
+    int scale = max(1, window->scale / 120);
+
+    /* buffers must be a multiple of the buffer scale */
+    if (window->width % scale || window->height % scale) scale = 1;
+    wl_surface_set_buffer_scale(window->surface, scale);
+    width /= scale;
+    height /= scale;
+    TRACE("buffer %dx%d buffer scale %d\n", window->width, window->height, scale);
+  }
+
+  if (width != window->surface_width || height != window->surface_height) {
+    if (window->gdi_regions) {
+      invalidate_gdi_regions();
+    } else {
+      region = wl_compositor_create_region(wayland_compositor);
+      if (!window->translucent) wl_region_add(region, 0, 0, width, height);
+      wl_surface_set_opaque_region(window->surface, region);
+      wl_region_destroy(region);
+    }
+    window->surface_width = width;
+    window->surface_height = height;
+  }
+
+  if (window->egl_window)
+    wl_egl_window_resize(window->egl_window, window->width, window->height, 0, 0);
+
+  wayland_window_check_scanout(window);
+}
+
+static void wayland_window_set_scale (struct wayland_window *window, int scale) {
+  if (scale <= 0 || scale == window->scale) return;
+  TRACE("preferred scale %d/120\n", scale);
+  window->scale = scale;
+  wayland_window_update_geometry(window);
+}
+
+static void wayland_surface_enter (void *data, struct wl_surface *surface, struct wl_output *output) {
+  struct wayland_window *window = data;
+
+  window->output = output;
+  /* wp_fractional_scale_v1 takes precedence over the output scale */
+  if (!window->fractional_scale)
+    wayland_window_set_scale(window, wayland_output_get_scale(output) * 120);
+  else
+    wayland_window_check_scanout(window);
+}
+
+static void wayland_surface_leave (void *data, struct wl_surface *surface, struct wl_output *output) {
+  struct wayland_window *window = data;
+
+  if (window->output == output) window->output = NULL;
+}
+
+static const struct wl_surface_listener wayland_surface_listener = {
+  wayland_surface_enter,
+  wayland_surface_leave
+};
+
+static void fractional_scale_preferred_scale (void *data, struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+  wayland_window_set_scale(data, scale);
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+  fractional_scale_preferred_scale
+};
+
+static void wayland_window_init_scale (struct wayland_window *window, int32_t width, int32_t height) {
+  window->width = width;
+  window->height = height;
+  window->scale = 120;
+  window->surface_width = 0;
+  window->surface_height = 0;
+  window->output = NULL;
+  window->viewport = NULL;
+  window->fractional_scale = NULL;
+  window->fullscreen = FALSE;
+  window->gdi_surface = NULL;
+  window->gdi_subsurface = NULL;
+  window->gdi_mapped = FALSE;
+  window->gdi_regions = FALSE;
+  window->translucent = FALSE;
+  /* a new main surface may need the GDI regions */
+  invalidate_gdi_regions();
+
+  wl_surface_add_listener(window->surface, &wayland_surface_listener, window);
+  if (wayland_viewporter)
+    window->viewport = wp_viewporter_get_viewport(wayland_viewporter, window->surface);
+  /* fractional scales can only be applied through a viewport */
+  if (fractional_scale_manager && window->viewport) {
+    window->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(fractional_scale_manager, window->surface);
+    wp_fractional_scale_v1_add_listener(window->fractional_scale, &fractional_scale_listener, window);
+  }
+  wayland_window_update_geometry(window);
+}
+
+static void wayland_window_set_fullscreen (struct wayland_window *window, BOOL fullscreen) {
+  struct wl_output *output = NULL;
+  RECT rect;
+
+  if (!window->shell_surface || fullscreen == window->fullscreen) return;
+
+  window->fullscreen = fullscreen;
+  if (fullscreen) {
+    /* go fullscreen on the output the window is on, not the primary */
+    if (global_vulkan_hwnd && GetWindowRect(global_vulkan_hwnd, &rect)) {
+      window->windowed_rect = rect;
+      output = wayland_output_for_rect(&rect);
+    }
+    wl_shell_surface_set_fullscreen(window->shell_surface,
+                                    WL_SHELL_SURFACE_FULLSCREEN_METHOD_DEFAULT,
+                                    0, output);
+  } else {
+    wl_shell_surface_set_toplevel(window->shell_surface);
+    rect = window->windowed_rect;
+    if (global_vulkan_hwnd && !IsRectEmpty(&rect))
+      SetWindowPos( global_vulkan_hwnd, HWND_TOP, 0, 0, rect.right - rect.left, rect.bottom - rect.top,
+                    SWP_NOACTIVATE | SWP_NOZORDER | SWP_ASYNCWINDOWPOS );
+  }
+  TRACE("fullscreen %d output %p\n", fullscreen, output);
+  wayland_window_check_scanout(window);
+}
+
+/* GDI content goes to a subsurface while vulkan presents to the main surface,
+ * returns NULL if it has to be dropped */
+static struct wl_surface *wayland_window_get_gdi_surface (struct wayland_window *window, HWND hwnd) {
+  struct wl_region *region;
+
+  if (!global_is_vulkan) return window->surface;
+  if (hwnd == global_vulkan_hwnd || !wayland_subcompositor || !window->surface) return NULL;
+
+  if (!window->gdi_surface) {
+    window->gdi_surface = wl_compositor_create_surface(wayland_compositor);
+    window->gdi_subsurface = wl_subcompositor_get_subsurface(wayland_subcompositor,
+                                                             window->gdi_surface, window->surface);
+    wl_subsurface_set_desync(window->gdi_subsurface);
+    /* the game keeps the input */
+    region = wl_compositor_create_region(wayland_compositor);
+    wl_surface_set_input_region(window->gdi_surface, region);
+    wl_region_destroy(region);
+  }
+  if (!window->gdi_mapped) {
+    window->gdi_mapped = TRUE;
+    wayland_window_check_scanout(window);
+  }
+  return window->gdi_surface;
+}
+
+static void wayland_window_unmap_gdi_surface (struct wayland_window *window) {
+  if (!window->gdi_mapped) return;
+  wl_surface_attach(window->gdi_surface, NULL, 0, 0);
+  wl_surface_commit(window->gdi_surface);
+  window->gdi_mapped = FALSE;
+  wayland_window_check_scanout(window);
+}
+
 static void create_wayland_window_mini (struct wayland_window *window) {
 	
 	
@@ -2575,18 +3454,14 @@ static void create_wayland_window (struct wayland_window *window, int32_t width,
 	EGL_NONE};
 	EGLConfig config;
 	EGLint num_config;
-  struct wl_region *region;
-  
 	eglChooseConfig (egl_display, attributes, &config, 1, &num_config);
 	window->egl_context = eglCreateContext (egl_display, config, EGL_NO_CONTEXT, NULL);
 	
 	window->surface = wl_compositor_create_surface (wayland_compositor);
 	window->shell_surface = wl_shell_get_shell_surface (wayland_shell, window->surface);
 	wl_shell_surface_add_listener (window->shell_surface, &shell_surface_listener, window);
-  
-  region = wl_compositor_create_region(wayland_compositor);
-  wl_region_add(region, 0, 0, width, height);
-  wl_surface_set_opaque_region(window->surface, region);
+  window->egl_window = NULL;
+  wayland_window_init_scale (window, width, height);
   
   window->test = 222;
 	wl_shell_surface_set_toplevel (window->shell_surface);
@@ -2595,6 +3470,15 @@ static void create_wayland_window (struct wayland_window *window, int32_t width,
 	eglMakeCurrent (egl_display, window->egl_surface, window->egl_surface, window->egl_context);
 }
 static void delete_wayland_window (struct wayland_window *window) {
+	if (window->fractional_scale) wp_fractional_scale_v1_destroy (window->fractional_scale);
+	if (window->viewport) wp_viewport_destroy (window->viewport);
+	window->fractional_scale = NULL;
+	window->viewport = NULL;
+	if (window->gdi_subsurface) wl_subsurface_destroy (window->gdi_subsurface);
+	if (window->gdi_surface) wl_surface_destroy (window->gdi_surface);
+	window->gdi_subsurface = NULL;
+	window->gdi_surface = NULL;
+	window->gdi_mapped = FALSE;
 	eglDestroySurface (egl_display, window->egl_surface);
 	wl_egl_window_destroy (window->egl_window);
 	wl_shell_surface_destroy (window->shell_surface);
@@ -2608,169 +3492,74 @@ static void draw_wayland_window (struct wayland_window *window) {
 }
 
 /***********************************************************************
- *		ClipCursor (WAYLANDDRV.@)
+ *		SetCursorPos (WAYLANDDRV.@)
+ *
+ * The wayland pointer can't be moved. A locked pointer gets a position
+ * hint used when the lock is released. While the cursor is hidden the
+ * offset to the real position is applied to the following motion events,
+ * a visible cursor stays where the user sees it.
  */
-BOOL CDECL WAYLANDDRV_ClipCursor( LPCRECT clip )
+BOOL CDECL WAYLANDDRV_SetCursorPos( INT x, INT y )
 {
-    
-    const char *is_vulkan = getenv( "WINE_VK_VULKAN_ONLY" );
-    if(!global_is_vulkan) { 
-      return TRUE;  
+    if (locked_pointer)
+    {
+        /* games recentering every frame send the same position again */
+        if (x == lock_hint.x && y == lock_hint.y) return TRUE;
+        zwp_locked_pointer_v1_set_cursor_position_hint( locked_pointer, wayland_screen_to_surface( x ),
+                                                        wayland_screen_to_surface( y ) );
+        lock_hint.x = x;
+        lock_hint.y = y;
+        return TRUE;
     }
-  
-    
-  
-    
-  
-  
-    if (!clip) { 
-      TRACE( "Release Mouse Capture Called \n" );
-          
-          if(wayland_confine) {
-      
-            
-            struct wl_cursor_image *image;
-            struct wl_buffer *buffer;
-            
-            zwp_locked_pointer_v1_destroy(locked_pointer);
-            zwp_relative_pointer_v1_destroy(relative_pointer);
-            locked_pointer = NULL;
-            relative_pointer = NULL;
-            
-            wayland_confine = 0;
-            
-            //show mouse if it's not hidden by env variable
-            if(!global_hide_cursor) {
-              image = wayland_default_cursor->images[0];
-              buffer = wl_cursor_image_get_buffer(image);
-              wl_pointer_set_cursor(wayland_pointer, wayland_serial_id,
-                wayland_cursor_surface,
-                image->hotspot_x,
-                image->hotspot_y);
-                wl_surface_attach(wayland_cursor_surface, buffer, 0, 0);
-                wl_surface_damage(wayland_cursor_surface, 0, 0,
-                image->width, image->height);
-              wl_surface_commit(wayland_cursor_surface);
-            }
-            
-          }
-          
-          
-          return TRUE;
-          
-    } 
-    
-    else {
-      
-      /*
-      TRACE( "Set Mouse Capture \n" );
-          
-      if(!wayland_confine) {
+    if (wayland_confine || !wayland_is_cursor_hidden()) return TRUE;
 
-        wayland_confine = 1;
-        locked_pointer = zwp_pointer_constraints_v1_lock_pointer( pointer_constraints,  vulkan_window.surface, wayland_pointer,               NULL,ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_ONESHOT);
-        
-        relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(relative_pointer_manager, wayland_pointer);
-        
-        zwp_relative_pointer_v1_add_listener(relative_pointer, &relative_pointer_listener, NULL);      
-        wl_surface_commit(vulkan_window.surface);
-        
-        //hide mouse
-        wl_pointer_set_cursor(wayland_pointer, wayland_serial_id, NULL, 0, 0);
-        //wl_surface_commit(wayland_cursor_surface);
-      } 
-     */
+    warp_x += x - (int)global_sx;
+    warp_y += y - (int)global_sy;
+    global_sx = x;
+    global_sy = y;
+    TRACE( "warp to %d,%d offset %d,%d\n", x, y, warp_x, warp_y );
+    return TRUE;
+}
 
-            
-     }
-     
-     
+/***********************************************************************
+ *		ClipCursor (WAYLANDDRV.@)
+ */
+BOOL CDECL WAYLANDDRV_ClipCursor( LPCRECT clip )
+{
+    RECT virtual_rect;
 
-     
-     
-        RECT virtual_rect = get_virtual_screen_rect();
-        HWND foreground = GetForegroundWindow();
+    if (!global_is_vulkan || !pointer_constraints || !wayland_pointer) return TRUE;
 
-        /*
-        TRACE("Virtual screen %s, clip rect %s", 
-          wine_dbgstr_rect( &virtual_rect ),
-          wine_dbgstr_rect( &clip )
-        );
-        */
+    if (!clip)
+    {
+        TRACE( "Release Mouse Capture Called \n" );
+        release_pointer_constraint();
+        return TRUE;
+    }
 
-        // we are clipping if the clip rectangle is smaller than the screen
-        if (clip->left > virtual_rect.left || clip->right < virtual_rect.right ||
-            clip->top > virtual_rect.top || clip->bottom < virtual_rect.bottom)
-        {
-            //if (grab_clipping_window( clip )) return TRUE;
-            TRACE( "Set Mouse Capture \n" );
-          
-            if(!wayland_confine) {
-      
-              wayland_confine = 1;
-              locked_pointer = zwp_pointer_constraints_v1_lock_pointer( pointer_constraints,  vulkan_window.surface, wayland_pointer,               NULL,ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT);
-              
-              relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(relative_pointer_manager, wayland_pointer);
-              zwp_relative_pointer_v1_add_listener(relative_pointer, &relative_pointer_listener, NULL);      
-              wl_surface_commit(vulkan_window.surface);
-              
-              //hide mouse
-              wl_pointer_set_cursor(wayland_pointer, wayland_serial_id, NULL, 0, 0);
-            }
-          
-        }
-        else // if currently clipping, check if we should switch to fullscreen clipping
-        {
-          
-           
-          
-          //TODO
-          //Re-enable with environment variable
-          
-          if(!global_hide_cursor) {
-          
-            TRACE( "Release Mouse Capture \n" );
-            
-            if(wayland_confine) {
-        
-              
-              struct wl_cursor_image *image;
-              struct wl_buffer *buffer;
-              
-              zwp_locked_pointer_v1_destroy(locked_pointer);
-              zwp_relative_pointer_v1_destroy(relative_pointer);
-              locked_pointer = NULL;
-              relative_pointer = NULL;
-              
-              wayland_confine = 0;
-              
-              //show mouse
-              if(!global_hide_cursor) {
-                image = wayland_default_cursor->images[0];
-                buffer = wl_cursor_image_get_buffer(image);
-                wl_pointer_set_cursor(wayland_pointer, wayland_serial_id,
-                  wayland_cursor_surface,
-                  image->hotspot_x,
-                  image->hotspot_y);
-                  wl_surface_attach(wayland_cursor_surface, buffer, 0, 0);
-                  wl_surface_damage(wayland_cursor_surface, 0, 0,
-                  image->width, image->height);
-                 
-                 wl_surface_commit(wayland_cursor_surface);
-              }
-              
-            }
-            
-            return TRUE;
+    virtual_rect = get_virtual_screen_rect();
 
-          }
-          
-        }
-    
-    
+    /* we are clipping if the clip rectangle is smaller than the screen */
+    if (clip->left > virtual_rect.left || clip->right < virtual_rect.right ||
+        clip->top > virtual_rect.top || clip->bottom < virtual_rect.bottom)
+    {
+        TRACE( "clip %s\n", wine_dbgstr_rect( clip ) );
+        /* games that hide the cursor want relative motion, the others
+         * keep the absolute position inside the rectangle */
+        if (wayland_is_cursor_hidden()) lock_pointer( ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT );
+        else confine_pointer( clip );
+    }
+    else if (global_hide_cursor)
+    {
+        /* the whole screen, keep the pointer locked for games that draw their own cursor */
+        TRACE( "keeping the pointer constraint\n" );
+    }
+    else
+    {
+        TRACE( "Release Mouse Capture \n" );
+        release_pointer_constraint();
+    }
     return TRUE;
-    
-    
 }
 
 
@@ -2797,7 +3586,8 @@ void CDECL WAYLANDDRV_SetCapture( HWND hwnd, UINT flags )
           locked_pointer = zwp_pointer_constraints_v1_lock_pointer( pointer_constraints,  vulkan_window.surface, wayland_pointer,               NULL,ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_ONESHOT);
           
           relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(relative_pointer_manager, wayland_pointer);
-          zwp_relative_pointer_v1_add_listener(relative_pointer, &relative_pointer_listener, NULL);      
+          zwp_relative_pointer_v1_add_listener(relative_pointer,
+              wayland_input_relative_pointer_listener(relative_pointer, &relative_pointer_listener), NULL);
           wl_surface_commit(vulkan_window.surface);
           
           //hide mouse
@@ -2869,7 +3659,7 @@ static inline int get_dib_image_size( const BITMAPINFO *info )
 
 /* Window surface support */
 
-static inline int context_idx( HWND hwnd  )
+static inline unsigned int context_idx( HWND hwnd  )
 {
     return LOWORD( hwnd ) >> 1;
 }
@@ -2883,15 +3673,65 @@ struct android_win_data
     RECT           client_rect;    /* client area relative to parent */
     struct wayland_window *window;         /* native window wrapper that forwards calls to the desktop process */
     struct window_surface *surface;
+    struct list    free_entry;     /* entry in the deferred free list once freed */
 };
 
 
 static CRITICAL_SECTION win_data_section;
+static CRITICAL_SECTION_DEBUG win_data_critsect_debug =
+{
+    0, 0, &win_data_section,
+    { &win_data_critsect_debug.ProcessLocksList, &win_data_critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": win_data_section") }
+};
+static CRITICAL_SECTION win_data_section = { &win_data_critsect_debug, -1, 0, 0, 0, 0 };
+
+/* hwnd to window data map, an open addressing hash table indexed by the
+ * handle index. Lookups probe without the lock: the slots hold the full
+ * handle next to the data, so probing never touches window data, and
+ * slots and tables are published with interlocked writes. A miss is
+ * retried under win_data_section, which writers hold. Tables are never
+ * modified in place once published, outgrown tables and freed window data
+ * are only released when no lock-free reader is running. */
+struct win_data_slot
+{
+    HWND volatile                     hwnd;   /* 0 if never used */
+    struct android_win_data * volatile data;
+};
+
+struct win_data_table
+{
+    struct win_data_table   *prev;    /* retired table, freed with the pending window data */
+    unsigned int             size;    /* power of two */
+    unsigned int             count;   /* live entries */
+    unsigned int             used;    /* live entries and tombstones */
+    struct win_data_slot     entries[1];
+};
+
+#define WIN_DATA_TOMBSTONE ((HWND)1)
+#define WIN_DATA_INITIAL_SIZE 64
 
-static struct android_win_data *win_data_context[32768];
+static struct win_data_table * volatile win_data_table;
+static LONG win_data_readers;     /* lock-free lookups in progress */
+static struct list win_data_free_list = LIST_INIT( win_data_free_list );
 
 static void set_surface_region( struct window_surface *window_surface, HRGN win_region );
 
+/* the window region as a list of spans for each row of the surface, so the
+ * copy never has to walk the region rectangles */
+struct region_span
+{
+    int left;
+    int right;
+};
+
+struct region_spans
+{
+    int                 height;   /* rows below have no spans */
+    unsigned int       *rows;     /* index of the first span of each row, height + 1 entries */
+    struct region_span  spans[1];
+};
+
 struct android_window_surface
 {
     struct window_surface header;
@@ -2900,11 +3740,16 @@ struct android_window_surface
     RECT                  bounds;
     BOOL                  byteswap;
     RGNDATA              *region_data;
+    struct region_spans  *spans;        /* region_data as spans, NULL if there is no region */
     HRGN                  region;
     BYTE                  alpha;
     COLORREF              color_key;
     void                 *bits;
     CRITICAL_SECTION      crit;
+    struct list           flush_entry;  /* entry in the flush queue, holds a reference */
+    BOOL                  queued;       /* in the flush queue, protected by gdi_buffer_section */
+    RECT                  damage;       /* damage waiting for the flusher, protected by crit */
+    struct list           entry;        /* entry in gdi_surfaces, protected by gdi_buffer_section */
     BITMAPINFO            info;   /* variable size, must be last */
 };
 
@@ -2934,30 +3779,121 @@ static void set_color_info( BITMAPINFO *info, BOOL has_alpha )
     colors[2] = 0x0000ff;
 }
 
-/* apply the window region to a single line of the destination image. */
-// ????
-/*
-static void apply_line_region( DWORD *dst, int width, int x, int y, const RECT *rect, const RECT *end )
+/***********************************************************************
+ *           create_region_spans
+ *
+ * Convert region data to spans for rows 0 to height - 1. The region
+ * rectangles are sorted in bands of equal top and bottom, so each row is
+ * covered by the rectangles of a single band.
+ */
+static struct region_spans *create_region_spans( const RGNDATA *data, int height )
 {
-    while (rect < end && rect->top <= y && width > 0)
+    const RECT *rect = (const RECT *)data->Buffer, *end = rect + data->rdh.nCount, *band;
+    struct region_spans *spans;
+    unsigned int count = 0, n = 0;
+    int y;
+
+    if (height <= 0) return NULL;
+    for (band = rect; band < end; band++)
+        count += max( 0, min( band->bottom, height ) - max( band->top, 0 ));
+
+    if (!(spans = HeapAlloc( GetProcessHeap(), 0, FIELD_OFFSET( struct region_spans, spans[count] ) +
+                             (height + 1) * sizeof(*spans->rows) )))
+        return NULL;
+    spans->height = height;
+    spans->rows = (unsigned int *)&spans->spans[count];
+
+    for (y = 0; y < height; y++)
     {
-        if (rect->left > x)
+        spans->rows[y] = n;
+        while (rect < end && rect->bottom <= y) rect++;
+        for (band = rect; band < end && band->top <= y; band++)
         {
-            memset( dst, 0, min( rect->left - x, width ) * sizeof(*dst) );
-            dst += rect->left - x;
-            width -= rect->left - x;
-            x = rect->left;
+            spans->spans[n].left = band->left;
+            spans->spans[n].right = band->right;
+            n++;
         }
-        if (rect->right > x)
+    }
+    spans->rows[height] = n;
+    return spans;
+}
+
+
+/* find the slot of a window, or the free slot where it would go */
+static struct win_data_slot *win_data_slot( struct win_data_table *table, HWND hwnd )
+{
+    unsigned int mask = table->size - 1, i = context_idx( hwnd ) & mask;
+    struct win_data_slot *free_slot = NULL;
+    HWND key;
+
+    while ((key = table->entries[i].hwnd))
+    {
+        if (key == hwnd) return &table->entries[i];
+        if (key == WIN_DATA_TOMBSTONE && !free_slot) free_slot = &table->entries[i];
+        i = (i + 1) & mask;
+    }
+    return free_slot ? free_slot : &table->entries[i];
+}
+
+/* release the retired tables and freed window data once no lock-free
+ * reader can still see them, must be called with win_data_section held */
+static void reclaim_win_data(void)
+{
+    struct android_win_data *data, *next;
+    struct win_data_table *table, *prev;
+
+    if (InterlockedCompareExchange( &win_data_readers, 0, 0 )) return;
+
+    LIST_FOR_EACH_ENTRY_SAFE( data, next, &win_data_free_list, struct android_win_data, free_entry )
+    {
+        list_remove( &data->free_entry );
+        HeapFree( GetProcessHeap(), 0, data );
+    }
+    if (!win_data_table) return;
+    for (table = win_data_table->prev; table; table = prev)
+    {
+        prev = table->prev;
+        heap_free( table );
+    }
+    win_data_table->prev = NULL;
+}
+
+/* make room for one more entry, must be called with win_data_section held */
+static BOOL grow_win_data_table(void)
+{
+    struct win_data_table *old = win_data_table, *table;
+    struct win_data_slot *slot;
+    unsigned int i, size;
+
+    /* keep at least a quarter of the slots empty so probes terminate quickly */
+    if (old && (old->used + 1) * 4 <= old->size * 3) return TRUE;
+
+    if (!old) size = WIN_DATA_INITIAL_SIZE;
+    /* mostly tombstones, a table of the same size is enough */
+    else if ((old->count + 1) * 2 <= old->size) size = old->size;
+    else size = old->size * 2;
+
+    if (!(table = heap_alloc_zero( FIELD_OFFSET( struct win_data_table, entries[size] )))) return FALSE;
+    table->size = size;
+    table->prev = old;
+    if (old)
+    {
+        /* readers may be probing the old table, it is left untouched */
+        for (i = 0; i < old->size; i++)
         {
-            dst += rect->right - x;
-            width -= rect->right - x;
-            x = rect->right;
+            if (!old->entries[i].data) continue;
+            slot = win_data_slot( table, old->entries[i].hwnd );
+            slot->data = old->entries[i].data;
+            slot->hwnd = old->entries[i].hwnd;
+            table->count++;
         }
-        rect++;
+        table->used = table->count;
+        TRACE( "win data table rehashed to %u entries for %u windows\n", size, table->count );
     }
-    if (width > 0) memset( dst, 0, width * sizeof(*dst) );
-}*/
+    InterlockedExchangePointer( (void **)&win_data_table, table );
+    reclaim_win_data();
+    return TRUE;
+}
 
 
 /***********************************************************************
@@ -2966,79 +3902,242 @@ static void apply_line_region( DWORD *dst, int width, int x, int y, const RECT *
 static struct android_win_data *alloc_win_data( HWND hwnd )
 {
     struct android_win_data *data;
+    struct win_data_slot *slot;
+
+    if (!(data = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*data)))) return NULL;
+    data->hwnd = hwnd;
+    //data->window = create_ioctl_window( hwnd, FALSE );
+    data->window = &vulkan_window;
 
-    if ((data = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*data))))
+    EnterCriticalSection( &win_data_section );
+    if (!grow_win_data_table())
+    {
+        LeaveCriticalSection( &win_data_section );
+        HeapFree( GetProcessHeap(), 0, data );
+        return NULL;
+    }
+    slot = win_data_slot( win_data_table, hwnd );
+    if (slot->hwnd == hwnd && slot->data)
     {
-        data->hwnd = hwnd;
-        //data->window = create_ioctl_window( hwnd, FALSE );
-        data->window = &vulkan_window;
-        //EnterCriticalSection( &win_data_section );
-        win_data_context[context_idx(hwnd)] = data;
-        //LeaveCriticalSection( &win_data_section );
+        /* another thread created it first */
+        struct android_win_data *prev = slot->data;
+        LeaveCriticalSection( &win_data_section );
+        HeapFree( GetProcessHeap(), 0, data );
+        return prev;
     }
+    if (!slot->hwnd) win_data_table->used++;
+    win_data_table->count++;
+    /* the data is set before the key, a reader matching the key finds it */
+    InterlockedExchangePointer( (void **)&slot->data, data );
+    InterlockedExchangePointer( (void **)&slot->hwnd, hwnd );
+    LeaveCriticalSection( &win_data_section );
     return data;
 }
 
 
 /***********************************************************************
  *           free_win_data
+ *
+ * The memory is only released once no lock-free lookup is running. The
+ * data returned by get_win_data is used without a reference, so only the
+ * thread owning the window may free it, from DestroyWindow; other threads
+ * forward their changes to it with window messages.
  */
 static void free_win_data( struct android_win_data *data )
 {
-    win_data_context[context_idx( data->hwnd )] = NULL;
+    struct win_data_slot *slot;
+    DWORD tid = GetWindowThreadProcessId( data->hwnd, NULL );
+
+    /* handles that are no windows, like those of the stress test, have no owner */
+    assert( !tid || tid == GetCurrentThreadId() );
+
+    EnterCriticalSection( &win_data_section );
+    slot = win_data_slot( win_data_table, data->hwnd );
+    if (slot->hwnd == data->hwnd && slot->data == data)
+    {
+        InterlockedExchangePointer( (void **)&slot->hwnd, WIN_DATA_TOMBSTONE );
+        InterlockedExchangePointer( (void **)&slot->data, NULL );
+        win_data_table->count--;
+    }
+    /* data->window is the shared vulkan_window, it is not owned by the window data */
+    list_add_tail( &win_data_free_list, &data->free_entry );
+    reclaim_win_data();
     LeaveCriticalSection( &win_data_section );
-    if (data->window) release_ioctl_window( data->window );
-    HeapFree( GetProcessHeap(), 0, data );
 }
 
 
+static struct android_win_data *find_win_data( HWND hwnd )
+{
+    struct android_win_data *data = NULL;
+    struct win_data_table *table;
+    struct win_data_slot *slot;
+
+    /* count the reader before loading the table, so nothing it can reach is freed */
+    InterlockedIncrement( &win_data_readers );
+    if ((table = win_data_table))
+    {
+        slot = win_data_slot( table, hwnd );
+        if (slot->hwnd == hwnd) data = slot->data;
+        /* the slot may have been reused between the two reads */
+        if (data && data->hwnd != hwnd) data = NULL;
+    }
+    InterlockedDecrement( &win_data_readers );
+    return data;
+}
+
 /***********************************************************************
  *           get_win_data
  *
- * Lock and return the data structure associated with a window.
+ * Return the data structure associated with a window. The data is not
+ * locked and not referenced: it may only be used by the thread owning
+ * the window, the only one that frees it, see free_win_data.
  */
 static struct android_win_data *get_win_data( HWND hwnd )
 {
     struct android_win_data *data;
 
     if (!hwnd) return NULL;
-    //EnterCriticalSection( &win_data_section );
-    if ((data = win_data_context[context_idx(hwnd)]) && data->hwnd == hwnd) {
-      return data;
-    }  
-    //LeaveCriticalSection( &win_data_section );
-    return NULL;
+    if ((data = find_win_data( hwnd ))) return data;
+
+    EnterCriticalSection( &win_data_section );
+    data = find_win_data( hwnd );
+    LeaveCriticalSection( &win_data_section );
+    return data;
 }
 
-/***********************************************************************
- *           android_surface_lock
- */
-static void android_surface_lock( struct window_surface *window_surface )
-{
-    struct android_window_surface *surface = get_android_surface( window_surface );
+/* Stress test of the window data table, run at startup when the
+ * win_data_stress option is set. Writer threads create and destroy
+ * windows with fake handles and check that the lock-free lookup always
+ * finds their live windows while the table grows and is rehashed, reader
+ * threads hammer the lookup on the handles of the other threads. */
+#define STRESS_WRITERS    4
+#define STRESS_READERS    2
+#define STRESS_WINDOWS    200   /* per writer, enough to grow the table */
+#define STRESS_ROUNDS     200
 
-    //EnterCriticalSection( &surface->crit );
-}
+static LONG stress_failures;
+static LONG stress_done;
 
-/***********************************************************************
- *           android_surface_unlock
- */
-static void android_surface_unlock( struct window_surface *window_surface )
+static HWND stress_hwnd( unsigned int thread, unsigned int index, unsigned int round )
 {
-    struct android_window_surface *surface = get_android_surface( window_surface );
-
-    //LeaveCriticalSection( &surface->crit );
+    /* never a real handle: generation above what the server hands out */
+    return (HWND)(ULONG_PTR)(((0x7000 + round) << 16) | ((0x1000 + thread * STRESS_WINDOWS + index) << 1));
 }
 
-/***********************************************************************
- *           android_surface_get_bitmap_info
- */
-static void *android_surface_get_bitmap_info( struct window_surface *window_surface, BITMAPINFO *info )
+static DWORD CALLBACK stress_writer( void *arg )
 {
-    struct android_window_surface *surface = get_android_surface( window_surface );
+    unsigned int thread = (UINT_PTR)arg, i, round;
+    struct android_win_data *data[STRESS_WINDOWS];
+    HWND hwnd;
 
-    memcpy( info, &surface->info, get_dib_info_size( &surface->info, DIB_RGB_COLORS ));
-    return surface->bits;
+    for (round = 0; round < STRESS_ROUNDS; round++)
+    {
+        for (i = 0; i < STRESS_WINDOWS; i++)
+        {
+            hwnd = stress_hwnd( thread, i, round );
+            if (!(data[i] = alloc_win_data( hwnd ))) InterlockedIncrement( &stress_failures );
+        }
+        for (i = 0; i < STRESS_WINDOWS; i++)
+        {
+            hwnd = stress_hwnd( thread, i, round );
+            if (data[i] && find_win_data( hwnd ) != data[i])
+            {
+                ERR( "live window %p not found\n", hwnd );
+                InterlockedIncrement( &stress_failures );
+            }
+        }
+        for (i = 0; i < STRESS_WINDOWS; i++)
+        {
+            if (!data[i]) continue;
+            hwnd = data[i]->hwnd;
+            free_win_data( data[i] );
+            if (get_win_data( hwnd ))
+            {
+                ERR( "destroyed window %p still found\n", hwnd );
+                InterlockedIncrement( &stress_failures );
+            }
+        }
+    }
+    InterlockedIncrement( &stress_done );
+    return 0;
+}
+
+static DWORD CALLBACK stress_reader( void *arg )
+{
+    unsigned int seed = (UINT_PTR)arg, thread, i, round;
+    struct android_win_data *data;
+    HWND hwnd;
+
+    while (InterlockedCompareExchange( &stress_done, 0, 0 ) < STRESS_WRITERS)
+    {
+        seed = seed * 1103515245 + 12345;
+        thread = (seed >> 8) % STRESS_WRITERS;
+        i = (seed >> 12) % STRESS_WINDOWS;
+        round = (seed >> 20) % STRESS_ROUNDS;
+        hwnd = stress_hwnd( thread, i, round );
+        if ((data = find_win_data( hwnd )) && data->hwnd != hwnd)
+        {
+            ERR( "lookup of %p returned the data of %p\n", hwnd, data->hwnd );
+            InterlockedIncrement( &stress_failures );
+        }
+    }
+    return 0;
+}
+
+/***********************************************************************
+ *           wayland_win_data_stress_test
+ */
+void wayland_win_data_stress_test(void)
+{
+    HANDLE threads[STRESS_WRITERS + STRESS_READERS];
+    unsigned int i, count = 0;
+    DWORD start = GetTickCount();
+
+    for (i = 0; i < STRESS_WRITERS; i++)
+        if ((threads[count] = CreateThread( NULL, 0, stress_writer, (void *)(UINT_PTR)i, 0, NULL ))) count++;
+    for (i = 0; i < STRESS_READERS; i++)
+        if ((threads[count] = CreateThread( NULL, 0, stress_reader, (void *)(UINT_PTR)(i + 1), 0, NULL ))) count++;
+    if (count < ARRAY_SIZE(threads))
+    {
+        ERR( "failed to create the stress threads\n" );
+        InterlockedExchange( &stress_done, STRESS_WRITERS );
+    }
+    WaitForMultipleObjects( count, threads, TRUE, INFINITE );
+    for (i = 0; i < count; i++) CloseHandle( threads[i] );
+
+    if (stress_failures) ERR( "win data stress test: %d failures\n", stress_failures );
+    else MESSAGE( "win data stress test passed in %u ms\n", GetTickCount() - start );
+}
+
+/***********************************************************************
+ *           android_surface_lock
+ */
+static void android_surface_lock( struct window_surface *window_surface )
+{
+    struct android_window_surface *surface = get_android_surface( window_surface );
+
+    EnterCriticalSection( &surface->crit );
+}
+
+/***********************************************************************
+ *           android_surface_unlock
+ */
+static void android_surface_unlock( struct window_surface *window_surface )
+{
+    struct android_window_surface *surface = get_android_surface( window_surface );
+
+    LeaveCriticalSection( &surface->crit );
+}
+
+/***********************************************************************
+ *           android_surface_get_bitmap_info
+ */
+static void *android_surface_get_bitmap_info( struct window_surface *window_surface, BITMAPINFO *info )
+{
+    struct android_window_surface *surface = get_android_surface( window_surface );
+
+    memcpy( info, &surface->info, get_dib_info_size( &surface->info, DIB_RGB_COLORS ));
+    return surface->bits;
 }
 
 /***********************************************************************
@@ -3156,355 +4255,735 @@ int create_shared_fd(off_t size)
     return fd;
 }
 #endif 
-int is_buffer_busy = 0;
+/* The GDI windows share one shm buffer. Drawing threads only record
+ * their damage in android_surface_flush and queue the surface, the flush
+ * worker thread copies the queued surfaces and commits, so neither the
+ * pixel copy nor the compositor ever stalls a drawing thread. */
+static CRITICAL_SECTION gdi_buffer_section;
+static CRITICAL_SECTION_DEBUG gdi_buffer_critsect_debug =
+{
+    0, 0, &gdi_buffer_section,
+    { &gdi_buffer_critsect_debug.ProcessLocksList, &gdi_buffer_critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": gdi_buffer_section") }
+};
+static CRITICAL_SECTION gdi_buffer_section = { &gdi_buffer_critsect_debug, -1, 0, 0, 0, 0 };
+
+static struct list gdi_flush_queue = LIST_INIT( gdi_flush_queue );
+static struct list gdi_surfaces = LIST_INIT( gdi_surfaces );
+static BOOL gdi_regions_dirty;  /* the opaque and input regions of the GDI surface must be recomputed */
+static HWND gdi_regions_hwnd;   /* global_update_hwnd when they were computed */
+static BOOL gdi_flushing;   /* a thread is running flush_gdi_surfaces */
+static HANDLE gdi_flush_event;   /* wakes up the flush worker */
+static INIT_ONCE gdi_flush_once = INIT_ONCE_STATIC_INIT;
+
+/* commits are paced by frame callbacks, damage accumulates until the
+ * compositor is ready for the next frame. A surface that is hidden gets
+ * no callbacks, so give up waiting after a while and flush anyway. */
+static struct wl_callback *gdi_frame_callback;
+static DWORD gdi_frame_time;
+#define GDI_FRAME_TIMEOUT 1000
+
+static void gdi_frame_done( void *data, struct wl_callback *callback, uint32_t time )
+{
+    BOOL current;
+
+    EnterCriticalSection( &gdi_buffer_section );
+    if ((current = (callback == gdi_frame_callback))) gdi_frame_callback = NULL;
+    LeaveCriticalSection( &gdi_buffer_section );
+    if (!current) return;  /* already dropped */
+
+    wl_callback_destroy( callback );
+    if (gdi_flush_event) SetEvent( gdi_flush_event );
+}
+
+static const struct wl_callback_listener gdi_frame_listener =
+{
+    gdi_frame_done
+};
+
+static void invalidate_gdi_regions(void)
+{
+    EnterCriticalSection( &gdi_buffer_section );
+    gdi_regions_dirty = TRUE;
+    LeaveCriticalSection( &gdi_buffer_section );
+}
+
+/* must be called with gdi_buffer_section held */
+static void drop_gdi_frame_callback(void)
+{
+    if (!gdi_frame_callback) return;
+    wl_callback_destroy( gdi_frame_callback );
+    gdi_frame_callback = NULL;
+}
+
+/* The shared buffer is a small ring of wl_buffers over one shm pool,
+ * covering the virtual screen. The wl_buffers live as long as the pool
+ * and are only recreated when the virtual screen size changes. When a
+ * render node is available the ring uses linux-dmabuf buffers instead,
+ * drawn in a CPU shadow and uploaded rectangle by rectangle. The pixels
+ * are premultiplied ARGB, transparent where no window is drawn. */
+struct gdi_buffer
+{
+    struct wl_buffer *buffer;
+    struct wayland_dmabuf_buffer *dmabuf;   /* GPU side buffer, bits is then its shadow */
+    uint32_t         *bits;
+    BOOL              busy;   /* held by the compositor, protected by gdi_buffer_section */
+    RECT              stale;  /* damage committed from the other buffers since this one was used */
+};
+
+#define GDI_BUFFER_COUNT 2
+
+static struct gdi_buffer gdi_buffers[GDI_BUFFER_COUNT];
+static struct gdi_buffer *gdi_last_buffer;   /* last committed buffer */
+static int gdi_buffer_width, gdi_buffer_height;
+static int gdi_buffer_fd = -1;
+static void *gdi_buffer_data;
+static size_t gdi_buffer_size;
+static struct wl_shm_pool *gdi_buffer_pool;
+static uint32_t *gdi_buffer_shadow;   /* shadows of the dmabuf buffers */
+
+/* protocol traffic of the GDI path, traced with each commit; requests counts
+ * every request sent for the buffers, regions and commits */
+static struct
+{
+    unsigned int commits;
+    unsigned int requests;
+    unsigned int buffers_created;
+} gdi_stats;
 
 
 static void buffer_release(void *data, struct wl_buffer *buffer) {
-	is_buffer_busy = 0;
-  wl_buffer_destroy(buffer);
+  struct gdi_buffer *gdi_buffer = data;
+
+  EnterCriticalSection( &gdi_buffer_section );
+  gdi_buffer->busy = FALSE;
+  LeaveCriticalSection( &gdi_buffer_section );
+  /* flush what was queued while the compositor held the buffer */
+  if (gdi_flush_event) SetEvent( gdi_flush_event );
 }
 
 static const struct wl_buffer_listener buffer_listener = {
 	buffer_release
 };
 
-//temp file support for wl_shm
+static void destroy_gdi_buffers(void)
+{
+    unsigned int i;
 
-int global_gdi_fd = 0;
-typedef uint32_t pixel;
-void *global_shm_data = NULL;
-struct wl_buffer *global_wl_buffer = NULL;
-struct wl_shm_pool *global_wl_pool = NULL;
-/***********************************************************************
- *           android_surface_flush
- */
-//Basic GDI windows support - mostly not working
+    for (i = 0; i < GDI_BUFFER_COUNT; i++)
+    {
+        if (gdi_buffers[i].buffer) gdi_stats.requests++;
+        if (gdi_buffers[i].dmabuf) wayland_dmabuf_destroy_buffer( gdi_buffers[i].dmabuf );
+        else if (gdi_buffers[i].buffer) wl_buffer_destroy( gdi_buffers[i].buffer );
+        memset( &gdi_buffers[i], 0, sizeof(gdi_buffers[i]) );
+    }
+    gdi_last_buffer = NULL;
+    heap_free( gdi_buffer_shadow );
+    gdi_buffer_shadow = NULL;
+    if (gdi_buffer_pool)
+    {
+        wl_shm_pool_destroy( gdi_buffer_pool );
+        gdi_stats.requests++;
+    }
+    gdi_buffer_pool = NULL;
+    if (gdi_buffer_data) munmap( gdi_buffer_data, gdi_buffer_size );
+    gdi_buffer_data = NULL;
+    if (gdi_buffer_fd >= 0) close( gdi_buffer_fd );
+    gdi_buffer_fd = -1;
+    gdi_buffer_width = gdi_buffer_height = 0;
+}
 
-//https://github.com/wayland-project/weston/blob/3957863667c15bc5f1984ddc6c5967a323f41e7a/clients/simple-shm.c
-static void android_surface_flush( struct window_surface *window_surface )
+/* try to create the ring on the render node, the shadows share one allocation */
+static BOOL create_dmabuf_gdi_buffers( int width, int height )
 {
-  
-  
-  
-  
-    if(!wayland_display) {
-      return;  
+    size_t count = (size_t)width * height;
+    unsigned int i;
+
+    for (i = 0; i < GDI_BUFFER_COUNT; i++)
+    {
+        if (!(gdi_buffers[i].dmabuf = wayland_dmabuf_create_buffer( width, height ))) goto fail;
+        gdi_buffers[i].buffer = wayland_dmabuf_get_wl_buffer( gdi_buffers[i].dmabuf );
     }
-  
-    if(is_buffer_busy) {
-      //TRACE("buffer is busy  \n" );
-      return;
+    if (!(gdi_buffer_shadow = heap_alloc_zero( count * GDI_BUFFER_COUNT * sizeof(*gdi_buffer_shadow) )))
+        goto fail;
+
+    for (i = 0; i < GDI_BUFFER_COUNT; i++)
+    {
+        gdi_buffers[i].bits = gdi_buffer_shadow + i * count;
+        wl_buffer_add_listener( gdi_buffers[i].buffer, &buffer_listener, &gdi_buffers[i] );
+        reset_bounds( &gdi_buffers[i].stale );
     }
-    
-    
-    struct android_window_surface *surface = get_android_surface( window_surface );
-    
-    if(!surface) {
-      return;  
+    /* the buffer objects start undefined, upload the black shadows once */
+    for (i = 0; i < GDI_BUFFER_COUNT; i++)
+        wayland_dmabuf_upload( gdi_buffers[i].dmabuf, gdi_buffers[i].bits, &(RECT){ 0, 0, width, height } );
+    /* params, plane, buffer and params destroy for each */
+    gdi_stats.requests += 4 * GDI_BUFFER_COUNT;
+    return TRUE;
+
+fail:
+    destroy_gdi_buffers();
+    return FALSE;
+}
+
+/***********************************************************************
+ *           ensure_gdi_buffers
+ *
+ * Make sure the buffer ring matches the virtual screen size, only called
+ * by the flusher. Returns FALSE if it has to wait for the compositor to
+ * release the old buffers first.
+ */
+static BOOL ensure_gdi_buffers( int width, int height )
+{
+    int stride = width * 4; // 4 bytes per pixel
+    size_t size = (size_t)stride * height;
+    unsigned int i;
+    BOOL busy = FALSE;
+
+    if (width == gdi_buffer_width && height == gdi_buffer_height) return TRUE;
+    if (width <= 0 || height <= 0) return FALSE;
+
+    EnterCriticalSection( &gdi_buffer_section );
+    for (i = 0; i < GDI_BUFFER_COUNT; i++) busy |= gdi_buffers[i].busy;
+    LeaveCriticalSection( &gdi_buffer_section );
+    if (busy) return FALSE;
+
+    TRACE( "creating %u gdi buffers %dx%d\n", GDI_BUFFER_COUNT, width, height );
+    destroy_gdi_buffers();
+
+    if (create_dmabuf_gdi_buffers( width, height ))
+    {
+        TRACE( "using dmabuf gdi buffers\n" );
+        goto done;
     }
-    
-    if(!surface->hwnd) {
-      return;  
+
+    gdi_buffer_fd = memfd_create("wine-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (gdi_buffer_fd < 0) {
+      ERR( "memfd_create failed: %s\n", strerror(errno) );
+      return FALSE;
     }
-    
-    if(global_update_hwnd && surface->hwnd != global_update_hwnd) {
-      TRACE("global_update_hwnd is %p and surface hwnd is %p \n", global_update_hwnd, surface->hwnd);
-      return;  
+    gdi_buffer_size = size * GDI_BUFFER_COUNT;
+    if (ftruncate( gdi_buffer_fd, gdi_buffer_size ) < 0) {
+      ERR( "ftruncate failed: %s\n", strerror(errno) );
+      destroy_gdi_buffers();
+      return FALSE;
     }
-    
-    
-    
-    HWND parent;
-    parent = GetParent( surface->hwnd );
-    
-    HWND owner;
-    owner = GetWindow( surface->hwnd, GW_OWNER );
-    
-    if ( parent && parent != GetDesktopWindow() ) {
-      TRACE("Parent hwnd is %p \n", parent);
-      //return;
+    /* the pool never shrinks */
+    fcntl(gdi_buffer_fd, F_ADD_SEALS, F_SEAL_SHRINK);
+
+    gdi_buffer_data = mmap(NULL, gdi_buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, gdi_buffer_fd, 0);
+    if (gdi_buffer_data == MAP_FAILED) {
+      ERR( "mmap failed: %s\n", strerror(errno) );
+      gdi_buffer_data = NULL;
+      destroy_gdi_buffers();
+      return FALSE;
     }
-    
-    
-    RECT client_rect;
-    
-    //if(!parent && global_hwnd_popup_mode) {
-    //  return;
-    //}
-    
-    if(surface->hwnd && !owner) {
-      GetWindowRect(surface->hwnd, &client_rect);
-      //TRACE("Client Rect rect %s \n", wine_dbgstr_rect( &client_rect ));
+
+    gdi_buffer_pool = wl_shm_create_pool(shm, gdi_buffer_fd, gdi_buffer_size);
+    for (i = 0; i < GDI_BUFFER_COUNT; i++)
+    {
+        gdi_buffers[i].bits = (uint32_t *)((char *)gdi_buffer_data + i * size);
+        gdi_buffers[i].buffer = wl_shm_pool_create_buffer( gdi_buffer_pool, i * size, width, height,
+                                                           stride, WL_SHM_FORMAT_ARGB8888 );
+        wl_buffer_add_listener( gdi_buffers[i].buffer, &buffer_listener, &gdi_buffers[i] );
+        reset_bounds( &gdi_buffers[i].stale );
     }
-    
-    //surface->hwnd
-    
-    if(surface->hwnd && owner) {
-      GetWindowRect(surface->hwnd, &client_rect);
-      TRACE("Client Rect rect %s \n", wine_dbgstr_rect( &client_rect ));
+    gdi_stats.requests += 1 + GDI_BUFFER_COUNT;  /* pool and buffers */
+done:
+    gdi_buffer_width = width;
+    gdi_buffer_height = height;
+    gdi_stats.buffers_created += GDI_BUFFER_COUNT;
+    return TRUE;
+}
+
+/* bring a buffer up to date with the last committed one, returns the updated rect in updated */
+static void update_stale_gdi_buffer( struct gdi_buffer *buffer, RECT *updated )
+{
+    RECT rect = buffer->stale;
+    int y;
+
+    reset_bounds( &buffer->stale );
+    SetRectEmpty( updated );
+    if (!gdi_last_buffer || gdi_last_buffer == buffer) return;
+    if (!IntersectRect( &rect, &rect, &(RECT){ 0, 0, gdi_buffer_width, gdi_buffer_height } )) return;
+    *updated = rect;
+
+    for (y = rect.top; y < rect.bottom; y++)
+        memcpy( buffer->bits + y * gdi_buffer_width + rect.left,
+                gdi_last_buffer->bits + y * gdi_buffer_width + rect.left,
+                (rect.right - rect.left) * sizeof(*buffer->bits) );
+}
+
+static inline BOOL is_gdi_surface_shown( const struct android_window_surface *surface )
+{
+    return !global_update_hwnd || surface->hwnd == global_update_hwnd;
+}
+
+/* a surface that is opaque inside of its window region */
+static inline BOOL is_gdi_surface_opaque( const struct android_window_surface *surface )
+{
+    return surface->alpha == 255 && surface->color_key == CLR_INVALID &&
+           surface->info.bmiHeader.biCompression != BI_RGB;
+}
+
+/* scale the premultiplied channels of a pixel by alpha */
+static inline uint32_t scale_pixel( uint32_t pixel, unsigned int alpha )
+{
+    uint32_t rb = (pixel & 0x00ff00ff) * alpha;
+    uint32_t ag = ((pixel >> 8) & 0x00ff00ff) * alpha;
+
+    rb = ((rb + 0x00800080 + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    ag = (ag + 0x00800080 + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return rb | ag;
+}
+
+/* copy pixels that are inside the window region, applying the layered attributes */
+static void copy_surface_pixels( const struct android_window_surface *surface, uint32_t *dst,
+                                 const uint32_t *src, int width )
+{
+    BOOL src_alpha = surface->info.bmiHeader.biCompression == BI_RGB;
+    unsigned int alpha = surface->alpha;
+    uint32_t pixel;
+    int x;
+
+    if (alpha == 255 && surface->color_key == CLR_INVALID && !src_alpha)
+    {
+        for (x = 0; x < width; x++) dst[x] = src[x] | 0xff000000;
+        return;
     }
-  
-    TRACE("Surface hwnd to paint is %p \n", surface->hwnd);
-    //MapWindowPoints( 0, global_vulkan_hwnd, &pt, 1 );
-  
-    int stride = 1440 * 4; // 4 bytes per pixel
-    int size = stride * 900;
-    int HEIGHT = 900;
-    int WIDTH = 1440;
-    
-    if(!global_gdi_fd) {
-      
-      TRACE( "creating gdi fd \n" );
-      
-      global_gdi_fd = memfd_create("wine-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
-      if (global_gdi_fd >= 0) {
-        /* We can add this seal before calling posix_fallocate(), as
-         * the file is currently zero-sized anyway.
-         *
-         * There is also no need to check for the return value, we
-         * couldn't do anything with it anyway.
-         */
-        fcntl(global_gdi_fd, F_ADD_SEALS, F_SEAL_SHRINK);
-      } else {
-        exit(1);  
-      }
-      posix_fallocate(global_gdi_fd, 0, size);
-      
+
+    for (x = 0; x < width; x++)
+    {
+        pixel = src[x];
+        if ((pixel & 0xffffff) == surface->color_key) pixel = 0;
+        else
+        {
+            if (!src_alpha) pixel |= 0xff000000;
+            if (alpha != 255) pixel = scale_pixel( pixel, alpha );
+        }
+        dst[x] = pixel;
     }
-    
-    
-    //MAP_SHARED
-    if(!global_shm_data) {
-      
-      void *shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, global_gdi_fd, 0);
+}
 
-      
-      
-      if (shm_data == MAP_FAILED) {
-        fprintf(stderr, "mmap failed: %m\n");
+/* copy a line of a surface, x and y are the surface coordinates of its first pixel.
+ * Pixels outside of the window region are transparent. */
+static void copy_surface_line( const struct android_window_surface *surface, uint32_t *dst,
+                               const uint32_t *src, int x, int y, int width )
+{
+    const struct region_span *span, *end;
+    int left = x, right;
+
+    if (!surface->spans)
+    {
+        copy_surface_pixels( surface, dst, src, width );
         return;
-        close(global_gdi_fd);      
-        
-      } else {
-        global_shm_data = shm_data;
-      }
-      
-      TRACE( "creating wl_shm_data \n" );
     }
 
-    
-    
-    
-    
-    
-    if(!global_wl_pool) {
-      TRACE( "creating wl_pool \n" );
-      global_wl_pool = wl_shm_create_pool(shm, global_gdi_fd, size);
+    if (y >= 0 && y < surface->spans->height)
+    {
+        span = surface->spans->spans + surface->spans->rows[y];
+        end = surface->spans->spans + surface->spans->rows[y + 1];
+        for (; span < end && left < x + width; span++)
+        {
+            if ((right = min( span->left, x + width )) > left)
+            {
+                memset( dst + left - x, 0, (right - left) * sizeof(*dst) );
+                left = right;
+            }
+            if ((right = min( span->right, x + width )) > left)
+            {
+                copy_surface_pixels( surface, dst + left - x, src + left - x, right - left );
+                left = right;
+            }
+        }
     }
-    //if(!global_wl_buffer) {
-      
-      
-    //}
-    is_buffer_busy = 1;
-    
-    
-    
-    
-    
-    
+    if (left < x + width) memset( dst + left - x, 0, (x + width - left) * sizeof(*dst) );
+}
+
+/* copy the damaged part of a surface to a buffer, only called by the flusher */
+static void copy_surface_bits( struct android_window_surface *surface, RECT rect,
+                               struct gdi_buffer *buffer, const RECT *virtual_rect, RECT *damage )
+{
+    RECT window_rect, dst, unclipped;
+    uint32_t *src_pixels;
+    uint32_t *dest_pixels;
+    int x, y, width;
     
-  
+    if (!is_gdi_surface_shown( surface )) {
+      TRACE("global_update_hwnd is %p and surface hwnd is %p \n", global_update_hwnd, surface->hwnd);
+      return;  
+    }
     
+    GetWindowRect(surface->hwnd, &window_rect);
   
-    
-    
-    //struct wl_buffer *buffer;
+    TRACE("Surface hwnd to paint is %p rect %s \n", surface->hwnd, wine_dbgstr_rect( &rect ));
+
+    /* position in the buffer, clipped to it */
+    if (!IntersectRect( &rect, &rect, &surface->header.rect )) return;
+    unclipped = rect;
+    OffsetRect( &unclipped, window_rect.left - virtual_rect->left, window_rect.top - virtual_rect->top );
+    if (!IntersectRect( &dst, &unclipped, &(RECT){ 0, 0, gdi_buffer_width, gdi_buffer_height } )) return;
+    /* rect stays in surface coordinates, shrunk by what the buffer clipped */
+    rect.left += dst.left - unclipped.left;
+    rect.top += dst.top - unclipped.top;
+    rect.right += dst.right - unclipped.right;
+    rect.bottom += dst.bottom - unclipped.bottom;
+
+    src_pixels = (unsigned int *)surface->bits
+            + (rect.top - surface->header.rect.top) * surface->info.bmiHeader.biWidth
+            + (rect.left - surface->header.rect.left);
+    dest_pixels = buffer->bits + dst.top * gdi_buffer_width + dst.left;
+    width = dst.right - dst.left;
+    x = rect.left - surface->header.rect.left;
+
+    for (y = rect.top - surface->header.rect.top; y < rect.bottom - surface->header.rect.top; y++)
+    {
+        copy_surface_line( surface, dest_pixels, src_pixels, x, y, width );
+        src_pixels += surface->info.bmiHeader.biWidth;
+        dest_pixels += gdi_buffer_width;
+    }
+    UnionRect( damage, damage, &dst );
+}
+
+/* convert a region in buffer coordinates to a wl_region */
+static struct wl_region *create_wl_region( HRGN rgn )
+{
+    struct wl_region *region;
+    RGNDATA *data;
+    RECT *rects;
+    DWORD size, i;
+
+    if (!(size = GetRegionData( rgn, 0, NULL ))) return NULL;
+    if (!(data = HeapAlloc( GetProcessHeap(), 0, size ))) return NULL;
+    if (!GetRegionData( rgn, size, data ))
+    {
+        HeapFree( GetProcessHeap(), 0, data );
+        return NULL;
+    }
+    region = wl_compositor_create_region( wayland_compositor );
+    rects = (RECT *)data->Buffer;
+    for (i = 0; i < data->rdh.nCount; i++)
+        wl_region_add( region, rects[i].left, rects[i].top,
+                       rects[i].right - rects[i].left, rects[i].bottom - rects[i].top );
+    gdi_stats.requests += 1 + data->rdh.nCount;
+    TRACE( "%s, %u rects\n", wine_dbgstr_rect( &data->rdh.rcBound ), data->rdh.nCount );
+    HeapFree( GetProcessHeap(), 0, data );
+    return region;
+}
+
+/* the part of the buffer a surface is drawn to, clipped to the window region */
+static HRGN get_gdi_surface_region( struct android_window_surface *surface, const RECT *virtual_rect )
+{
+    HRGN rgn, region;
     RECT rect;
-    BOOL needs_flush;
 
-    //window_surface->funcs->lock( window_surface );
-    SetRect( &rect, 0, 0, surface->header.rect.right - surface->header.rect.left,
-             surface->header.rect.bottom - surface->header.rect.top );
-             
-    
-    /*
-    TRACE( "flushing %p hwnd %p rect %s %s \n",
-           surface, surface->hwnd, wine_dbgstr_rect( &rect ), wine_dbgstr_rect( &surface->bounds ) );
-    */
-    //??
-    //Checks and reduces rect to changed areas
-    
-    needs_flush = IntersectRect( &rect, &rect, &surface->bounds );
-    reset_bounds( &surface->bounds );
-    //window_surface->funcs->unlock( window_surface );
-    //if (!needs_flush) return;
+    if (!GetWindowRect( surface->hwnd, &rect )) return 0;
+    OffsetRect( &rect, -virtual_rect->left, -virtual_rect->top );
+    rgn = CreateRectRgn( rect.left, rect.top, rect.right, rect.bottom );
 
-    //TRACE( "creating wl_buffer \n" );
-      
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(global_wl_pool, 0, WIDTH, HEIGHT, stride, WL_SHM_FORMAT_XRGB8888);
-    wl_buffer_add_listener(buffer, &buffer_listener, NULL);
-    
-    wl_surface_attach(vulkan_window.surface, buffer, 0, 0);
-  
-    
-    
-    
-    const RECT *rgn_rect = NULL, *end = NULL;
-    //unsigned int *src, *dst;
-    int x, y, width;
-    
-    
-    uint32_t *src_pixels;
-    uint32_t *dest_pixels;
-    //uint32_t *dest_pixels = (unsigned int *)shm_data;
-    
-    
-    /*
-    if(!global_update_hwnd) {
-      dest_pixels = (unsigned int *)global_shm_data + rect.top * WIDTH + rect.left;
-    } else {
-      
-    }*/
-    
-    //dest_pixels = (unsigned int *)global_shm_data + rect.top * WIDTH + rect.left;  
-    
-    
-    //if ( (!parent || parent == GetDesktopWindow() ) ) {
-      dest_pixels = (unsigned int *)global_shm_data + (client_rect.top + rect.top) * WIDTH + (client_rect.left + rect.left) ;
-    //}
-    
-    
-    //dest_pixels = (unsigned int *)global_shm_data + client_rect.top * WIDTH + client_rect.left;
-    
-    //paint_pixels(dest_pixels);
-    
-    IntersectRect( &rect, &rect, &surface->header.rect );
+    surface->header.funcs->lock( &surface->header );
+    if (surface->region_data && (region = ExtCreateRegion( NULL, surface->region_data->rdh.dwSize +
+                                                           surface->region_data->rdh.nRgnSize,
+                                                           surface->region_data )))
+    {
+        OffsetRgn( region, rect.left, rect.top );
+        CombineRgn( rgn, rgn, region, RGN_AND );
+        DeleteObject( region );
+    }
+    surface->header.funcs->unlock( &surface->header );
+    return rgn;
+}
+
+/***********************************************************************
+ *           update_gdi_regions
+ *
+ * The buffer is transparent where no window is drawn. Tell the compositor
+ * which parts are opaque so that it can skip blending them, and, when the
+ * GDI surface is the main surface, which parts take input so that clicks
+ * outside of shaped windows go through. Layered windows are not opaque,
+ * and since windows overwrite each other in the buffer the transparent
+ * parts of a window are also removed from the opaque ones.
+ */
+static void update_gdi_regions( struct wl_surface *gdi_surface, const RECT *virtual_rect )
+{
+    struct android_window_surface *surface;
+    struct wl_region *region;
+    HRGN opaque, translucent, input, rgn, rect_rgn;
+    RECT rect;
+
+    EnterCriticalSection( &gdi_buffer_section );
+    if (!gdi_regions_dirty && gdi_regions_hwnd == global_update_hwnd)
+    {
+        LeaveCriticalSection( &gdi_buffer_section );
+        return;
+    }
+    gdi_regions_dirty = FALSE;
+    gdi_regions_hwnd = global_update_hwnd;
+
+    opaque = CreateRectRgn( 0, 0, 0, 0 );
+    translucent = CreateRectRgn( 0, 0, 0, 0 );
+    input = CreateRectRgn( 0, 0, 0, 0 );
+    LIST_FOR_EACH_ENTRY( surface, &gdi_surfaces, struct android_window_surface, entry )
+    {
+        if (!is_gdi_surface_shown( surface ) || !(rgn = get_gdi_surface_region( surface, virtual_rect )))
+            continue;
+        CombineRgn( input, input, rgn, RGN_OR );
+        if (!is_gdi_surface_opaque( surface )) CombineRgn( translucent, translucent, rgn, RGN_OR );
+        else CombineRgn( opaque, opaque, rgn, RGN_OR );
+        if (surface->region_data && GetWindowRect( surface->hwnd, &rect ))
+        {
+            /* outside of the window region the window is transparent */
+            OffsetRect( &rect, -virtual_rect->left, -virtual_rect->top );
+            rect_rgn = CreateRectRgn( rect.left, rect.top, rect.right, rect.bottom );
+            CombineRgn( rect_rgn, rect_rgn, rgn, RGN_DIFF );
+            CombineRgn( translucent, translucent, rect_rgn, RGN_OR );
+            DeleteObject( rect_rgn );
+        }
+        DeleteObject( rgn );
+    }
+    LeaveCriticalSection( &gdi_buffer_section );
+
+    CombineRgn( opaque, opaque, translucent, RGN_DIFF );
+    if ((region = create_wl_region( opaque )))
+    {
+        wl_surface_set_opaque_region( gdi_surface, region );
+        wl_region_destroy( region );
+        gdi_stats.requests += 2;
+    }
+    /* a GDI subsurface leaves the input to the game */
+    vulkan_window.gdi_regions = (gdi_surface == vulkan_window.surface);
+    if (vulkan_window.gdi_regions && (region = create_wl_region( input )))
+    {
+        wl_surface_set_input_region( gdi_surface, region );
+        wl_region_destroy( region );
+        gdi_stats.requests += 2;
+    }
+    DeleteObject( opaque );
+    DeleteObject( translucent );
+    DeleteObject( input );
+}
+
+static void end_gdi_flush(void)
+{
+    EnterCriticalSection( &gdi_buffer_section );
+    gdi_flushing = FALSE;
+    LeaveCriticalSection( &gdi_buffer_section );
+}
 
-    if (surface->region_data)
+/***********************************************************************
+ *           flush_gdi_surfaces
+ *
+ * Copy all the queued surfaces to a free buffer and commit it. This
+ * normally runs on the flush worker, multiple flushes queued before it
+ * wakes up, while no buffer is free or until the frame callback of the
+ * last commit, are coalesced into a single commit.
+ */
+static void flush_gdi_surfaces(void)
+{
+    struct android_window_surface *surface;
+    struct gdi_buffer *buffer = NULL;
+    struct wl_surface *gdi_surface;
+    struct wl_callback *callback;
+    struct list *entry;
+    RECT rect, damage, virtual_rect, updated;
+    unsigned int i;
+
+    EnterCriticalSection( &gdi_buffer_section );
+    if (gdi_frame_callback && GetTickCount() - gdi_frame_time > GDI_FRAME_TIMEOUT)
     {
-        rgn_rect = (RECT *)surface->region_data->Buffer;
-        end = rgn_rect + surface->region_data->rdh.nCount;
+        TRACE( "no frame callback for %u ms, surface is probably hidden\n", GetTickCount() - gdi_frame_time );
+        drop_gdi_frame_callback();
     }
-    
-    //src_pixels = (unsigned int *)surface->bits;
-    
-    
-    
-    
-    src_pixels = (unsigned int *)surface->bits
-            + (rect.top - surface->header.rect.top) * surface->info.bmiHeader.biWidth
-            + (rect.left - surface->header.rect.left);
-    
-    if(src_pixels == dest_pixels) {
-      return;  
+    if (gdi_flushing || list_empty( &gdi_flush_queue ) || gdi_frame_callback)
+    {
+        /* the current flusher picks up our surface, or the next flush
+         * after the buffer release or the frame callback does */
+        LeaveCriticalSection( &gdi_buffer_section );
+        return;
     }
-    
-    //TRACE( "rect top %d %d %d %d \n", rect.top, rect.left, rect.right, rect.bottom );
-    
-    
-    width = min( rect.right - rect.left, stride );
-    
-    /*
-    TRACE( "flushing %p hwnd %p surface %s rect %s bits %p alpha %02x key %08x region %u rects\n",
-           surface, surface->hwnd, wine_dbgstr_rect( &surface->header.rect ),
-           wine_dbgstr_rect( &rect ), surface->bits, surface->alpha, surface->color_key,
-           surface->region_data ? surface->region_data->rdh.nCount : 0 );
-    */
-    /*
-    
-    TRACE( "width %d stride %d \n", width, stride);
-    TRACE( "compression %d %p \n", surface->info.bmiHeader.biCompression, surface->info.bmiHeader.biCompression);
-    // TRACE( "bitcount %d %p \n", surface->info.bmiHeader.biBitCount);
-    TRACE( "bitwidth %d %p \n", surface->info.bmiHeader.biWidth);
-    
-    
-    TRACE( "flushing %p hwnd %p surface %s rect %s bits %p alpha %02x key %08x region %u rects\n",
-           surface, surface->hwnd, wine_dbgstr_rect( &surface->header.rect ),
-           wine_dbgstr_rect( &rect ), surface->bits, surface->alpha, surface->color_key,
-           surface->region_data ? surface->region_data->rdh.nCount : 0 );
-    */
-    
-    //memcpy( dest_pixels, src_pixels, width * sizeof(*dest_pixels) );
-    
-    
-    
-    //width = 400;
-    
-    
-    
-    //for (y = rect.top; y < min( HEIGHT, rect.bottom); y++)
-    for (y = rect.top; y < min( HEIGHT, rect.bottom - 1); y++)
+    gdi_flushing = TRUE;
+    LeaveCriticalSection( &gdi_buffer_section );
+
+    virtual_rect = get_virtual_screen_rect();
+    if (!ensure_gdi_buffers( virtual_rect.right - virtual_rect.left, virtual_rect.bottom - virtual_rect.top ))
     {
-        
-        /*
-        for (x = 0; x < width; x++) { 
-          dest_pixels[x + (y * width)] = src_pixels[x] | 0xff000000;
-        } 
-        */
+        end_gdi_flush();
+        return;
+    }
 
-        for (x = 0; x < width; x++) { 
-        //for (x = 0; x < surface->info.bmiHeader.biWidth; x++) { 
-          dest_pixels[x] = src_pixels[x] | 0xff000000;      
-        }
-      
-      /*
-        if (surface->info.bmiHeader.biCompression == BI_RGB)
-            memcpy( dest_pixels, src_pixels, width * sizeof(*dest_pixels) );
-        else if (surface->alpha == 255)
-            for (x = 0; x < width; x++) dest_pixels[x] = src_pixels[x] | 0xff000000;
-        else
-            for (x = 0; x < width; x++)
-                dest_pixels[x] = ((surface->alpha << 24) |
-                          (((BYTE)(src_pixels[x] >> 16) * surface->alpha / 255) << 16) |
-                          (((BYTE)(src_pixels[x] >> 8) * surface->alpha / 255) << 8) |
-                          (((BYTE)src_pixels[x] * surface->alpha / 255)));
-      */
-        
-        ///????
-        //if (surface->color_key != CLR_INVALID)
-        //for (x = 0; x < width; x++) if ((src_pixels[x] & 0xffffff) == //surface->color_key) dest_pixels[x] = 0;
+    EnterCriticalSection( &gdi_buffer_section );
+    for (i = 0; i < GDI_BUFFER_COUNT; i++)
+    {
+        if (gdi_buffers[i].busy) continue;
+        buffer = &gdi_buffers[i];
+        buffer->busy = TRUE;  /* reserved until committed */
+        break;
+    }
+    LeaveCriticalSection( &gdi_buffer_section );
+    if (!buffer)
+    {
+        end_gdi_flush();
+        return;
+    }
 
-        if (rgn_rect)
+    update_stale_gdi_buffer( buffer, &updated );
+
+    gdi_surface = NULL;
+    reset_bounds( &damage );
+    for (;;)
+    {
+        EnterCriticalSection( &gdi_buffer_section );
+        if (!(entry = list_head( &gdi_flush_queue )))
         {
-            //while (rgn_rect < end && rgn_rect->bottom <= y) rgn_rect++;
-            //apply_line_region( dest_pixels, width, rect.left, y, rgn_rect, end );
+            gdi_flushing = FALSE;
+            LeaveCriticalSection( &gdi_buffer_section );
+            break;
         }
+        list_remove( entry );
+        surface = LIST_ENTRY( entry, struct android_window_surface, flush_entry );
+        surface->queued = FALSE;
+        LeaveCriticalSection( &gdi_buffer_section );
 
-        //src_pixels += surface->info.bmiHeader.biWidth;
-        //src_pixels += width;
-        src_pixels += surface->info.bmiHeader.biWidth;
-        dest_pixels += WIDTH;
+        if (!gdi_surface) gdi_surface = wayland_window_get_gdi_surface( &vulkan_window, surface->hwnd );
+
+        surface->header.funcs->lock( &surface->header );
+        rect = surface->damage;
+        reset_bounds( &surface->damage );
+        if (gdi_surface && !IsRectEmpty( &rect ))
+            copy_surface_bits( surface, rect, buffer, &virtual_rect, &damage );
+        surface->header.funcs->unlock( &surface->header );
+
+        window_surface_release( &surface->header );
     }
-    
-    
-    wl_surface_damage(vulkan_window.surface, 0, 0, WIDTH, HEIGHT);
-    wl_surface_commit(vulkan_window.surface);
-    
-    //wl_shm_pool_destroy(pool);
-    
-    return;
-    
-    
 
-    /*
-  
-    //if (!surface->window->perform( surface->window, NATIVE_WINDOW_LOCK, &buffer, &rc ))
-    //{
-        
+    if (!gdi_surface || IsRectEmpty( &damage ))
+    {
+        /* nothing to show, the buffer is still up to date with the last commit */
+        if (buffer->dmabuf) wayland_dmabuf_upload( buffer->dmabuf, buffer->bits, &updated );
+        EnterCriticalSection( &gdi_buffer_section );
+        buffer->busy = FALSE;
+        LeaveCriticalSection( &gdi_buffer_section );
+        return;
+    }
 
+    if (buffer->dmabuf)
+    {
+        /* the stale rect is the damage of the previous commit, usually next to this one */
+        UnionRect( &rect, &updated, &damage );
+        wayland_dmabuf_upload( buffer->dmabuf, buffer->bits, &rect );
+    }
 
-        
-        
-        src = (unsigned int *)surface->bits
-            + (rect.top - surface->header.rect.top) * surface->info.bmiHeader.biWidth
-            + (rect.left - surface->header.rect.left);
-        dst = (unsigned int *)buffer.bits + rect.top * buffer.stride + rect.left;
-        
+    for (i = 0; i < GDI_BUFFER_COUNT; i++)
+        if (&gdi_buffers[i] != buffer) UnionRect( &gdi_buffers[i].stale, &gdi_buffers[i].stale, &damage );
+    gdi_last_buffer = buffer;
 
-        
-        //surface->window->perform( surface->window, NATIVE_WINDOW_UNLOCK_AND_POST );
-    //}
-  */   
+    update_gdi_regions( gdi_surface, &virtual_rect );
+    wl_surface_attach(gdi_surface, buffer->buffer, 0, 0);
+    if (wl_surface_get_version( gdi_surface ) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+        wl_surface_damage_buffer( gdi_surface, damage.left, damage.top,
+                                  damage.right - damage.left, damage.bottom - damage.top );
+    else
+        wl_surface_damage( gdi_surface, 0, 0, gdi_buffer_width, gdi_buffer_height );
+
+    callback = wl_surface_frame( gdi_surface );
+    wl_callback_add_listener( callback, &gdi_frame_listener, NULL );
+    EnterCriticalSection( &gdi_buffer_section );
+    drop_gdi_frame_callback();
+    gdi_frame_callback = callback;
+    gdi_frame_time = GetTickCount();
+    LeaveCriticalSection( &gdi_buffer_section );
+
+    wl_surface_commit(gdi_surface);
+    /* the event thread may be blocked in poll, send the requests now */
+    wl_display_flush(wayland_display);
+
+    gdi_stats.commits++;
+    gdi_stats.requests += 4;  /* attach, one damage rect, frame, commit */
+    TRACE( "commit %u buffer %u damage %s, %u requests and %u wl_buffers created so far\n",
+           gdi_stats.commits, (unsigned int)(buffer - gdi_buffers), wine_dbgstr_rect( &damage ),
+           gdi_stats.requests, gdi_stats.buffers_created );
+}
+
+/* how long the worker can sleep before a lost frame callback must be given up */
+static DWORD get_gdi_flush_timeout(void)
+{
+    DWORD ret = INFINITE, elapsed;
+
+    EnterCriticalSection( &gdi_buffer_section );
+    if (gdi_frame_callback && !list_empty( &gdi_flush_queue ))
+    {
+        elapsed = GetTickCount() - gdi_frame_time;
+        ret = elapsed > GDI_FRAME_TIMEOUT ? 0 : GDI_FRAME_TIMEOUT - elapsed + 1;
+    }
+    LeaveCriticalSection( &gdi_buffer_section );
+    return ret;
+}
+
+static DWORD CALLBACK gdi_flush_worker( void *arg )
+{
+    for (;;)
+    {
+        WaitForSingleObject( gdi_flush_event, get_gdi_flush_timeout() );
+        flush_gdi_surfaces();
+    }
+    return 0;
+}
+
+static BOOL CALLBACK start_gdi_flush_worker( INIT_ONCE *once, void *param, void **context )
+{
+    HANDLE thread;
+
+    if (!(gdi_flush_event = CreateEventW( NULL, FALSE, FALSE, NULL ))) return TRUE;
+    if (!(thread = CreateThread( NULL, 0, gdi_flush_worker, NULL, 0, NULL )))
+    {
+        ERR( "failed to create the GDI flush thread, flushing synchronously\n" );
+        CloseHandle( gdi_flush_event );
+        gdi_flush_event = 0;
+        return TRUE;
+    }
+    CloseHandle( thread );
+    return TRUE;
+}
+
+/***********************************************************************
+ *           android_surface_flush
+ */
+//Basic GDI windows support - mostly not working
+
+//https://github.com/wayland-project/weston/blob/3957863667c15bc5f1984ddc6c5967a323f41e7a/clients/simple-shm.c
+static void android_surface_flush( struct window_surface *window_surface )
+{
+    struct android_window_surface *surface = get_android_surface( window_surface );
+    RECT rect;
+    BOOL needs_flush;
+
+    if(!wayland_display || !surface || !surface->hwnd) {
+      return;  
+    }
+
+    /* record the damage, the flusher copies it */
+    window_surface->funcs->lock( window_surface );
+    SetRect( &rect, 0, 0, surface->header.rect.right - surface->header.rect.left,
+             surface->header.rect.bottom - surface->header.rect.top );
+    needs_flush = IntersectRect( &rect, &rect, &surface->bounds );
+    reset_bounds( &surface->bounds );
+    if (needs_flush) UnionRect( &surface->damage, &surface->damage, &rect );
+    needs_flush = !IsRectEmpty( &surface->damage );
+    window_surface->funcs->unlock( window_surface );
+
+    if (!needs_flush) return;
+
+    EnterCriticalSection( &gdi_buffer_section );
+    if (!surface->queued)
+    {
+        window_surface_add_ref( window_surface );
+        list_add_tail( &gdi_flush_queue, &surface->flush_entry );
+        surface->queued = TRUE;
+    }
+    LeaveCriticalSection( &gdi_buffer_section );
+
+    InitOnceExecuteOnce( &gdi_flush_once, start_gdi_flush_worker, NULL, NULL );
+    if (gdi_flush_event) SetEvent( gdi_flush_event );
+    else flush_gdi_surfaces();
 }
 
 /***********************************************************************
@@ -3513,12 +4992,40 @@ static void android_surface_flush( struct window_surface *window_surface )
 static void android_surface_destroy( struct window_surface *window_surface )
 {
     struct android_window_surface *surface = get_android_surface( window_surface );
+    struct android_window_surface *other;
+    BOOL last = FALSE;
 
     TRACE( "freeing %p bits %p %p \n", surface, surface->bits, surface->hwnd );
 
-    //surface->crit.DebugInfo->Spare[0] = 0;
-    //DeleteCriticalSection( &surface->crit );
+    EnterCriticalSection( &gdi_buffer_section );
+    list_remove( &surface->entry );
+    gdi_regions_dirty = TRUE;
+    /* the GDI subsurface is shared, keep it while other GDI windows are drawn */
+    if (global_is_vulkan && surface->hwnd != global_vulkan_hwnd)
+    {
+        last = TRUE;
+        LIST_FOR_EACH_ENTRY( other, &gdi_surfaces, struct android_window_surface, entry )
+        {
+            if (other->hwnd == global_vulkan_hwnd) continue;
+            last = FALSE;
+            break;
+        }
+    }
+    LeaveCriticalSection( &gdi_buffer_section );
+
+    if (last)
+    {
+        wayland_window_unmap_gdi_surface( &vulkan_window );
+        /* an unmapped surface gets no more frame callbacks */
+        EnterCriticalSection( &gdi_buffer_section );
+        drop_gdi_frame_callback();
+        LeaveCriticalSection( &gdi_buffer_section );
+    }
+
+    surface->crit.DebugInfo->Spare[0] = 0;
+    DeleteCriticalSection( &surface->crit );
     HeapFree( GetProcessHeap(), 0, surface->region_data );
+    HeapFree( GetProcessHeap(), 0, surface->spans );
     if (surface->region) DeleteObject( surface->region );
     //release_ioctl_window( surface->window );
     HeapFree( GetProcessHeap(), 0, surface->bits );
@@ -3571,6 +5078,7 @@ static void set_surface_region( struct window_surface *window_surface, HRGN win_
 {
     struct android_window_surface *surface = get_android_surface( window_surface );
     struct android_win_data *win_data;
+    struct region_spans *spans = NULL;
     HRGN region = win_region;
     RGNDATA *data = NULL;
     DWORD size;
@@ -3601,14 +5109,18 @@ static void set_surface_region( struct window_surface *window_surface, HRGN win_
         HeapFree( GetProcessHeap(), 0, data );
         data = NULL;
     }
+    else spans = create_region_spans( data, surface->header.rect.bottom - surface->header.rect.top );
 
 done:
     window_surface->funcs->lock( window_surface );
     HeapFree( GetProcessHeap(), 0, surface->region_data );
+    HeapFree( GetProcessHeap(), 0, surface->spans );
     surface->region_data = data;
+    surface->spans = spans;
     *window_surface->funcs->get_bounds( window_surface ) = surface->header.rect;
     window_surface->funcs->unlock( window_surface );
     if (region != win_region) DeleteObject( region );
+    invalidate_gdi_regions();
 }
 
 /***********************************************************************
@@ -3630,9 +5142,9 @@ static struct window_surface *create_surface( HWND hwnd, const RECT *rect,
     surface->info.bmiHeader.biSizeImage   = get_dib_image_size( &surface->info );
 
   
-    //???
-    //InitializeCriticalSection( &surface->crit );
-    //surface->crit.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": surface");
+    InitializeCriticalSection( &surface->crit );
+    surface->crit.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": surface");
+    list_init( &surface->entry );
 
     surface->header.funcs = &android_surface_funcs;
     surface->header.rect  = *rect;
@@ -3643,6 +5155,7 @@ static struct window_surface *create_surface( HWND hwnd, const RECT *rect,
     set_color_key( surface, color_key );
     set_surface_region( &surface->header, (HRGN)1 );
     reset_bounds( &surface->bounds );
+    reset_bounds( &surface->damage );
 
     if (!(surface->bits = HeapAlloc( GetProcessHeap(), 0, surface->info.bmiHeader.biSizeImage )))
         goto failed;
@@ -3650,6 +5163,11 @@ static struct window_surface *create_surface( HWND hwnd, const RECT *rect,
     TRACE( "created %p hwnd %p %s bits %p-%p\n", surface, hwnd, wine_dbgstr_rect(rect),
            surface->bits, (char *)surface->bits + surface->info.bmiHeader.biSizeImage );
 
+    EnterCriticalSection( &gdi_buffer_section );
+    list_add_tail( &gdi_surfaces, &surface->entry );
+    gdi_regions_dirty = TRUE;
+    LeaveCriticalSection( &gdi_buffer_section );
+
     return &surface->header;
 
 failed:
@@ -3659,25 +5177,25 @@ failed:
 
 /***********************************************************************
  *           set_surface_layered
- ???
+ */
 static void set_surface_layered( struct window_surface *window_surface, BYTE alpha, COLORREF color_key )
 {
     struct android_window_surface *surface = get_android_surface( window_surface );
     COLORREF prev_key;
     BYTE prev_alpha;
 
-    if (window_surface->funcs != &android_surface_funcs) return;  
+    if (window_surface->funcs != &android_surface_funcs) return;  /* we may get the null surface */
 
     window_surface->funcs->lock( window_surface );
     prev_key = surface->color_key;
     prev_alpha = surface->alpha;
     surface->alpha = alpha;
     set_color_key( surface, color_key );
-    if (alpha != prev_alpha || surface->color_key != prev_key)  // refresh
+    if (alpha != prev_alpha || surface->color_key != prev_key)  /* refresh */
         *window_surface->funcs->get_bounds( window_surface ) = surface->header.rect;
     window_surface->funcs->unlock( window_surface );
+    invalidate_gdi_regions();
 }
-*/
 
 /*
 static WNDPROC desktop_orig_wndproc;
@@ -3706,7 +5224,7 @@ static LRESULT CALLBACK desktop_wndproc_wrapper( HWND hwnd, UINT msg, WPARAM wp,
  */
 void release_win_data( struct waylanddrv_win_data *data )
 {
-    if (data) LeaveCriticalSection( &win_data_section );
+    /* get_win_data doesn't lock, nothing to release */
 }
 
 /***********************************************************************
@@ -3840,10 +5358,7 @@ BOOL CDECL WAYLANDDRV_CreateDesktopWindow( HWND hwnd )
     return;
   
   
-    const char *is_vulkan = getenv( "WINE_VK_VULKAN_ONLY" );
-  
-  
-    if(is_vulkan) {
+    if(waylanddrv_config.vulkan_only) {
       return TRUE;  
     }
   
@@ -3880,9 +5395,7 @@ BOOL CDECL WAYLANDDRV_CreateDesktopWindow( HWND hwnd )
     struct window_surface *surface = NULL;
   
     if(global_gdi_enabled < 0) {
-      const char *vk_enabled = getenv("WINE_VK_VULKAN_ONLY");
-      
-      if(vk_enabled) {
+      if(waylanddrv_config.vulkan_only) {
         global_gdi_enabled = 0;
       } else {
         global_gdi_enabled = 1;
@@ -4061,10 +5574,7 @@ void CDECL WAYLANDDRV_WindowPosChanging( HWND hwnd, HWND insert_after, UINT swp_
     
   
   
-  const char *is_vulkan = getenv( "WINE_VK_VULKAN_ONLY" );
-  
-  
-  if(is_vulkan) {
+  if(waylanddrv_config.vulkan_only) {
     return;  
   }
   
@@ -4088,43 +5598,10 @@ void CDECL WAYLANDDRV_WindowPosChanging( HWND hwnd, HWND insert_after, UINT swp_
   if( !parent || parent != GetDesktopWindow()) {
     return;  
   }
-  //tooltips_class32
-  WCHAR class_name[64];
-  static const WCHAR desktop_class[] = {'#', '3', '2', '7', '6', '9', 0};
-  static const WCHAR menu_class[] = {'#', '3', '2', '7', '6', '8', 0};
-  static const WCHAR ole_class[] = {'O','l','e','M','a','i','n','T','h','r','e','a','d','W','n','d','C','l','a','s','s', 0};
-  static const WCHAR msg_class[] = {'M','e','s','s','a','g','e', 0};
-  static const WCHAR ime_class[] = {'I','M','E', 0};
-  static const WCHAR tooltip_class[] = {'t','o','o','l','t','i','p','s','_',
-  'c','l','a','s','s','3','2', 0};
-    
-    
-      
-      if(RealGetWindowClassW(hwnd, class_name, ARRAY_SIZE(class_name))) {
-        
-        
-      
-      if(!lstrcmpiW(class_name, menu_class)) {
-        //return TRUE;
-      }
-      if(!lstrcmpiW(class_name, msg_class)) {
-        return TRUE;
-      }
-      if(!lstrcmpiW(class_name, ole_class)) {
-        return TRUE;
-      }
-      if(!lstrcmpiW(class_name, ime_class)) {
-        return TRUE;
-      }
-      if(!lstrcmpiW(class_name, desktop_class)) {
-        return TRUE;
-      }
-      if(!lstrcmpiW(class_name, tooltip_class)) {
-        return TRUE;
-      }
-      
-      //SetWindowPos(hwnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOSIZE); 
-    }
+  //message, ole, ime, desktop and tooltip windows
+  if(get_window_class_flags(hwnd) & WAYLANDDRV_CLASS_IGNORED) {
+    return;
+  }
   
   
   /*
@@ -4181,25 +5658,9 @@ void CDECL WAYLANDDRV_WindowPosChanging( HWND hwnd, HWND insert_after, UINT swp_
   
   
   if(!wayland_display) {
-      desktop_tid = GetCurrentThreadId();
-      wayland_display = wl_display_connect (NULL);
-      if(!wayland_display) {
+      if(!wayland_connect_display()) {
         return;  
       }
-      struct wl_registry *registry = wl_display_get_registry (wayland_display);
-    
-  
-      //if(parent && parent != GetDesktopWindow()) {    
-      //SetWindowPos( global_vulkan_hwnd, HWND_TOP, 0, 0, 1440, 900,
-                  //SWP_NOACTIVATE | SWP_NOZORDER | SWP_NOSIZE);
-      //}  
-    
-    
-      wl_registry_add_listener (registry, &registry_listener, NULL);
-      wl_display_roundtrip (wayland_display);
-    
-      egl_display = eglGetDisplay (wayland_display);
-      eglInitialize (egl_display, NULL, NULL);
     
       create_wayland_window (&vulkan_window, 1440, 900);
       //draw_wayland_window (&wayland_window);
@@ -4267,15 +5728,29 @@ void CDECL WAYLANDDRV_WindowPosChanging( HWND hwnd, HWND insert_after, UINT swp_
       
       //if ( !owner & (!parent || parent == GetDesktopWindow()) ) {
       if ( (!parent || parent == GetDesktopWindow()) ) {
+        BYTE alpha = 255;
+        DWORD flags = 0;
+
+        key = CLR_INVALID;
+        if ((GetWindowLongW( hwnd, GWL_EXSTYLE ) & WS_EX_LAYERED) &&
+            GetLayeredWindowAttributes( hwnd, &key, &alpha, &flags ))
+        {
+            if (!(flags & LWA_COLORKEY)) key = CLR_INVALID;
+            if (!(flags & LWA_ALPHA)) alpha = 255;
+        }
+
         if (*surface) {
           window_surface_release( *surface );
         }
-        *surface = create_surface( data->hwnd, &rect, 255, key, FALSE );
-        //if (data->surface) {
-        //  window_surface_release( data->surface );
-        //}  
+        *surface = create_surface( data->hwnd, &rect, alpha, key, FALSE );
+        /* data->surface holds its own reference, used by SetWindowRgn and
+         * SetLayeredWindowAttributes */
+        if (data->surface) {
+          window_surface_release( data->surface );
+          data->surface = NULL;
+        }
         if (*surface) {
-          window_surface_add_ref( surface );
+          window_surface_add_ref( *surface );
           data->surface = *surface; 
         }
         
@@ -4417,10 +5892,9 @@ void CDECL WAYLANDDRV_WindowPosChanged( HWND hwnd, HWND insert_after, UINT swp_f
 {
     return;
   
-    const char *is_vulkan = getenv( "WINE_VK_VULKAN_ONLY" );
     struct android_win_data *data;
   
-    if(is_vulkan) {
+    if(waylanddrv_config.vulkan_only) {
       return;  
     }
   
@@ -4600,6 +6074,57 @@ void CDECL WAYLANDDRV_SetParent( HWND hwnd, HWND parent, HWND old_parent )
   
 }
 
+/***********************************************************************
+ *		SetWindowRgn   (WAYLANDDRV.@)
+ */
+void CDECL WAYLANDDRV_SetWindowRgn( HWND hwnd, HRGN hrgn, BOOL redraw )
+{
+    struct android_win_data *data;
+
+    /* the window data belongs to the window thread, it reads the region from the server */
+    if (GetWindowThreadProcessId( hwnd, NULL ) != GetCurrentThreadId())
+        SendMessageW( hwnd, WM_WAYLANDDRV_SET_WIN_REGION, 0, 0 );
+    else if ((data = get_win_data( hwnd )) && data->surface) set_surface_region( data->surface, hrgn );
+    else TRACE( "no surface for window %p\n", hwnd );
+}
+
+/***********************************************************************
+ *		SetLayeredWindowAttributes   (WAYLANDDRV.@)
+ */
+void CDECL WAYLANDDRV_SetLayeredWindowAttributes( HWND hwnd, COLORREF key, BYTE alpha, DWORD flags )
+{
+    struct android_win_data *data;
+
+    if (!(flags & LWA_ALPHA)) alpha = 255;
+    if (!(flags & LWA_COLORKEY)) key = CLR_INVALID;
+
+    if (GetWindowThreadProcessId( hwnd, NULL ) != GetCurrentThreadId())
+        SendMessageW( hwnd, WM_WAYLANDDRV_SET_LAYERED, alpha, key );
+    else if ((data = get_win_data( hwnd )) && data->surface) set_surface_layered( data->surface, alpha, key );
+}
+
+/***********************************************************************
+ *		WindowMessage   (WAYLANDDRV.@)
+ */
+LRESULT CDECL WAYLANDDRV_WindowMessage( HWND hwnd, UINT msg, WPARAM wp, LPARAM lp )
+{
+    struct android_win_data *data;
+
+    switch (msg)
+    {
+    case WM_WAYLANDDRV_SET_WIN_REGION:
+        /* region 1 means the current region of the window */
+        if ((data = get_win_data( hwnd )) && data->surface) set_surface_region( data->surface, (HRGN)1 );
+        return 0;
+    case WM_WAYLANDDRV_SET_LAYERED:
+        if ((data = get_win_data( hwnd )) && data->surface) set_surface_layered( data->surface, wp, lp );
+        return 0;
+    default:
+        FIXME( "got window msg %x hwnd %p wp %lx lp %lx\n", msg, hwnd, wp, lp );
+        return 0;
+    }
+}
+
 
 /**********************************************************************
  *		CreateWindow   (WAYLANDDRV.@)
@@ -4610,24 +6135,17 @@ BOOL CDECL WAYLANDDRV_CreateWindow( HWND hwnd )
     TRACE("Created window %p \n", hwnd);
   
     HWND parent;
-    WCHAR class_name[64];
+    UINT class_flags;
   
     //TODO revise
   
   
     
-    static const WCHAR menu_class[] = {'#', '3', '2', '7', '6', '8', 0};
-    static const WCHAR ole_class[] = {'O','l','e','M','a','i','n','T','h','r','e','a','d','W','n','d','C','l','a','s','s', 0};
-    static const WCHAR msg_class[] = {'M','e','s','s','a','g','e', 0};
-    static const WCHAR ime_class[] = {'I','M','E', 0};
     parent = GetAncestor(hwnd, GA_PARENT);
     HWND owner;
     owner = GetWindow( hwnd, GW_OWNER );
     
-    if(RealGetWindowClassW(hwnd, class_name, ARRAY_SIZE(class_name))) {
-      TRACE("%s \n", debugstr_w(class_name));
-       
-    }
+    class_flags = get_window_class_flags(hwnd);
     
     /*
     static const WCHAR sdl_class[] = {'S','D','L','H','e','l','p','e','r',
@@ -4672,17 +6190,10 @@ BOOL CDECL WAYLANDDRV_CreateWindow( HWND hwnd )
         }
       }
       #endif
-      //lstrcmpiW
-      if(!lstrcmpiW(class_name, msg_class)) {
+      if(class_flags & WAYLANDDRV_CLASS_IGNORED) {
         return TRUE;
       }
-      if(!lstrcmpiW(class_name, ole_class)) {
-        return TRUE;
-      }
-      if(!lstrcmpiW(class_name, ime_class)) {
-        return TRUE;
-      }
-      TRACE("desktop parent %s %p \n", debugstr_w(class_name), hwnd);
+      TRACE("desktop parent %p \n", hwnd);
       //global_update_hwnd = hwnd;
       //RedrawWindow(global_update_hwnd, 0, 0, RDW_INVALIDATE | RDW_ALLCHILDREN);
       //SetWindowPos(hwnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOSIZE); 
@@ -4911,11 +6422,21 @@ void CDECL WAYLANDDRV_DestroyWindow( HWND hwnd )
     TRACE("Destroyed window %p \n", hwnd);
   
     WCHAR class_name[164];
+    struct android_win_data *data;
     
-    if(GetClassNameW(hwnd, class_name, ARRAY_SIZE(class_name) )) {
+    if(TRACE_ON(waylanddrv) && GetClassNameW(hwnd, class_name, ARRAY_SIZE(class_name) )) {
       TRACE("Destroy window %s \n", debugstr_w(class_name));
     }
   
+    /* GDI windows keep their data while vulkan is active too */
+    if ((data = get_win_data( hwnd )))
+    {
+        /* user32 releases its own reference to the window surface */
+        if (data->surface) window_surface_release( data->surface );
+        data->surface = NULL;
+        free_win_data( data );
+    }
+
     if(global_is_vulkan) {
       //wine_vk_surface_destroy( hwnd );
       if(hwnd == global_vulkan_hwnd) {
@@ -4923,7 +6444,6 @@ void CDECL WAYLANDDRV_DestroyWindow( HWND hwnd )
       }
       return;
     }
-  
     
     if (global_update_hwnd == hwnd) {
       global_update_hwnd = NULL;
@@ -5007,15 +6527,14 @@ DWORD CDECL WAYLANDDRV_MsgWaitForMultipleObjectsEx( DWORD count, const HANDLE *h
              wl_display_dispatch_pending(wayland_display);             
           }
           wl_display_flush(wayland_display);
-          wl_display_read_events(wayland_display);
-          wl_display_dispatch_pending(wayland_display);
+          read_wayland_events();
           
         } 
         else {
           
           wl_display_flush(wayland_display);
-          wl_display_read_events(wayland_display);
-          wl_display_dispatch_pending(wayland_display);
+          read_wayland_events();
+          wayland_update_cursor_animation();
           
           if (count || timeout) {
               ret = WaitForMultipleObjectsEx( count, handles, flags & MWMO_WAITALL,
@@ -5171,6 +6690,17 @@ static VkResult WAYLANDDRV_vkCreateSwapchainKHR(VkDevice device,
     create_info_host = *create_info;
     create_info_host.surface = surface_from_handle(create_info->surface)->surface;
 
+    /* the swapchain decides the buffer size, keep the viewport in sync */
+    vulkan_window.width = create_info->imageExtent.width;
+    vulkan_window.height = create_info->imageExtent.height;
+    /* and whether the surface is opaque */
+    if (vulkan_window.translucent != (create_info->compositeAlpha != VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR)) {
+      vulkan_window.translucent = !vulkan_window.translucent;
+      vulkan_window.surface_width = 0;  /* recompute the opaque region */
+      TRACE("composite alpha %#x\n", create_info->compositeAlpha);
+    }
+    wayland_window_update_geometry(&vulkan_window);
+
     return pvkCreateSwapchainKHR(device, &create_info_host, NULL /* allocator */, swapchain);
 }
 
@@ -5183,6 +6713,7 @@ static VkResult WAYLANDDRV_vkCreateWin32SurfaceKHR(VkInstance instance,
     VkResult res;
     VkWaylandSurfaceCreateInfoKHR create_info_host;
     struct wine_vk_surface *x11_surface;
+    RECT client_rect;
     //, *prev;
   
     int no_flag = 1;
@@ -5200,25 +6731,8 @@ static VkResult WAYLANDDRV_vkCreateWin32SurfaceKHR(VkInstance instance,
 
     //Hack
     //Do not create vulkan windows for Paradox detect    
-    static const WCHAR pdx_class[] = {'P','d','x','D','e','t','e','c','t','W','i','n','d','o','w', 0};
-    //static const LPWSTR pdx_class = L"PdxDetectWindow" ;
-    WCHAR class_name[164];
-    //LPWSTR lpClassName;
-    
-    //TRACE("%s \n", debugstr_w(pdx_class));
-  
-    
-    //if(RealGetWindowClassW(create_info->hwnd, class_name, ARRAY_SIZE(class_name))) {
-    if(GetClassNameW(create_info->hwnd, class_name, ARRAY_SIZE(class_name) )) {
-       
-      //TRACE("%p, %s\n", class_name, debugstr_a(class_name));
-      TRACE("%s \n", debugstr_w(class_name));
-      //if it's a menu class reparent
-      
-      if(!lstrcmpiW(class_name, pdx_class)) {
-        no_flag = 0;
-        //return VK_SUCCESS;
-      }
+    if(get_window_class_flags(create_info->hwnd) & WAYLANDDRV_CLASS_NO_VULKAN) {
+      no_flag = 0;
     }
     
     //if vulkan_window already exists destroy it
@@ -5280,25 +6794,16 @@ static VkResult WAYLANDDRV_vkCreateWin32SurfaceKHR(VkInstance instance,
     
     
     
-  if(!wayland_display) {
-    desktop_tid = GetCurrentThreadId();
-    wayland_display = wl_display_connect (NULL);
-    if(!wayland_display) {
-      TRACE("Creating wayland display \n");
-      exit(1);  
-    }
-    struct wl_registry *registry = wl_display_get_registry (wayland_display);
-    wl_registry_add_listener (registry, &registry_listener, NULL);
-    wl_display_roundtrip (wayland_display);
-    
-    egl_display = eglGetDisplay (wayland_display);
-    eglInitialize (egl_display, NULL, NULL);
+  if(!wayland_connect_display()) {
+    exit(1);  
 	}
   
   
   
-	//struct wayland_window wayland_window;
-	create_wayland_window (&vulkan_window, 1600, 900);
+	/* start with the client size so the buffer and the opaque region match the game */
+	if (!GetClientRect(create_info->hwnd, &client_rect) || IsRectEmpty(&client_rect))
+		SetRect(&client_rect, 0, 0, 1600, 900);
+	create_wayland_window (&vulkan_window, client_rect.right, client_rect.bottom);
   //draw_wayland_window (&wayland_window);
 
   int count = 0;
@@ -46,7 +46,6 @@ int vulkan_is_running;
 unsigned long global_sx;
 unsigned long global_sy;
 
-int global_axis_dir;
 //End Wayland
 
 #define BOOL X_BOOL
@@ -436,6 +435,22 @@ extern HMODULE waylanddrv_module DECLSPEC_HIDDEN;
 extern char *process_name DECLSPEC_HIDDEN;
 extern Display *clipboard_display DECLSPEC_HIDDEN;
 
+/* driver options, resolved once in process_attach and read-only afterwards */
+struct waylanddrv_config
+{
+    BOOL vulkan_only;     /* WINE_VK_VULKAN_ONLY or VulkanOnly */
+    BOOL hide_cursor;     /* WINE_VK_HIDE_CURSOR or HideCursor */
+    int  screen_width;    /* WINE_VK_WAYLAND_WIDTH or Width */
+    int  screen_height;   /* WINE_VK_WAYLAND_HEIGHT or Height */
+    char ignored_classes[256]; /* WINE_VK_IGNORED_CLASSES or IgnoredClasses, comma separated */
+    BOOL use_dmabuf;      /* UseDmabuf, cleared by WINE_VK_NO_DMABUF */
+    char input_record[MAX_PATH]; /* WINE_VK_INPUT_RECORD or InputRecord, unix path */
+    char input_replay[MAX_PATH]; /* WINE_VK_INPUT_REPLAY or InputReplay, unix path */
+    BOOL win_data_stress; /* WINE_VK_WIN_DATA_STRESS or WinDataStress, self-test at startup */
+};
+
+extern struct waylanddrv_config waylanddrv_config DECLSPEC_HIDDEN;
+
 /* atoms */
 
 /* X11 event driver */
@@ -467,7 +482,8 @@ enum waylanddrv_window_messages
     WM_WAYLANDDRV_SET_WIN_REGION,
     WM_WAYLANDDRV_RESIZE_DESKTOP,
     WM_WAYLANDDRV_SET_CURSOR,
-    WM_WAYLANDDRV_CLIP_CURSOR
+    WM_WAYLANDDRV_CLIP_CURSOR,
+    WM_WAYLANDDRV_SET_LAYERED
 };
 
 /* _NET_WM_STATE properties that we keep track of */
@@ -567,6 +583,57 @@ extern POINT root_to_virtual_screen( INT x, INT y ) DECLSPEC_HIDDEN;
 extern RECT get_virtual_screen_rect(void) DECLSPEC_HIDDEN;
 extern RECT get_primary_monitor_rect(void) DECLSPEC_HIDDEN;
 extern void xinerama_init( unsigned int width, unsigned int height ) DECLSPEC_HIDDEN;
+extern void wayland_output_add( struct wl_registry *registry, uint32_t name, uint32_t version ) DECLSPEC_HIDDEN;
+extern BOOL wayland_output_remove( uint32_t name ) DECLSPEC_HIDDEN;
+extern void wayland_outputs_ready(void) DECLSPEC_HIDDEN;
+extern struct wl_output *wayland_output_for_rect( const RECT *rect ) DECLSPEC_HIDDEN;
+extern int wayland_output_get_scale( struct wl_output *wl_output ) DECLSPEC_HIDDEN;
+extern BOOL wayland_output_get_mode( struct wl_output *wl_output, int *width, int *height ) DECLSPEC_HIDDEN;
+
+/* dmabuf */
+struct wayland_dmabuf_buffer;
+
+extern void wayland_dmabuf_init( struct wl_registry *registry, uint32_t name, uint32_t version ) DECLSPEC_HIDDEN;
+extern struct wayland_dmabuf_buffer *wayland_dmabuf_create_buffer( int width, int height ) DECLSPEC_HIDDEN;
+extern struct wl_buffer *wayland_dmabuf_get_wl_buffer( struct wayland_dmabuf_buffer *buffer ) DECLSPEC_HIDDEN;
+extern BOOL wayland_dmabuf_upload( struct wayland_dmabuf_buffer *buffer, const uint32_t *bits,
+                                   const RECT *rect ) DECLSPEC_HIDDEN;
+extern void wayland_dmabuf_destroy_buffer( struct wayland_dmabuf_buffer *buffer ) DECLSPEC_HIDDEN;
+
+/* input recording and replay */
+struct zwp_relative_pointer_v1;
+struct zwp_relative_pointer_v1_listener;
+
+extern const struct wl_pointer_listener *wayland_input_pointer_listener( struct wl_pointer *pointer,
+        const struct wl_pointer_listener *listener ) DECLSPEC_HIDDEN;
+extern const struct wl_keyboard_listener *wayland_input_keyboard_listener( struct wl_keyboard *keyboard,
+        const struct wl_keyboard_listener *listener ) DECLSPEC_HIDDEN;
+extern const struct zwp_relative_pointer_v1_listener *wayland_input_relative_pointer_listener(
+        struct zwp_relative_pointer_v1 *pointer, const struct zwp_relative_pointer_v1_listener *listener ) DECLSPEC_HIDDEN;
+extern void wayland_input_relative_pointer_destroyed( struct zwp_relative_pointer_v1 *pointer ) DECLSPEC_HIDDEN;
+extern void wayland_input_record_flush(void) DECLSPEC_HIDDEN;
+extern int wayland_input_replay_fd(void) DECLSPEC_HIDDEN;
+extern void wayland_input_replay_dispatch(void) DECLSPEC_HIDDEN;
+
+/* window classes */
+#define WAYLANDDRV_CLASS_IGNORED   0x01  /* helper window, no surface */
+#define WAYLANDDRV_CLASS_NO_VULKAN 0x02  /* never gets the vulkan surface */
+
+extern UINT get_window_class_flags( HWND hwnd ) DECLSPEC_HIDDEN;
+
+/* cursor */
+extern struct wl_pointer *wayland_pointer DECLSPEC_HIDDEN;
+extern struct wl_surface *wayland_cursor_surface DECLSPEC_HIDDEN;
+extern struct wl_shm *wayland_cursor_shm DECLSPEC_HIDDEN;
+extern uint32_t wayland_serial_id DECLSPEC_HIDDEN;
+extern unsigned int wayland_confine DECLSPEC_HIDDEN;
+extern int global_hide_cursor DECLSPEC_HIDDEN;
+extern int wayland_get_cursor_scale(void) DECLSPEC_HIDDEN;
+extern void wayland_load_cursor_theme_async(void) DECLSPEC_HIDDEN;
+extern void wayland_show_cursor(void) DECLSPEC_HIDDEN;
+extern BOOL wayland_is_cursor_hidden(void) DECLSPEC_HIDDEN;
+extern void wayland_win_data_stress_test(void) DECLSPEC_HIDDEN;
+extern void wayland_update_cursor_animation(void) DECLSPEC_HIDDEN;
 
 struct waylanddrv_mode_info
 {
@@ -100,6 +100,19 @@ static char input_style[20];
 
 int esync_fd = -1;
 
+struct waylanddrv_config waylanddrv_config =
+{
+    FALSE,  /* vulkan_only */
+    FALSE,  /* hide_cursor */
+    1600,   /* screen_width */
+    900,    /* screen_height */
+    "",     /* ignored_classes */
+    TRUE,   /* use_dmabuf */
+    "",     /* input_record */
+    "",     /* input_replay */
+    FALSE   /* win_data_stress */
+};
+
 extern void __wine_esync_set_queue_fd( int fd );
 
 /* store the display fd into the message queue */
@@ -189,6 +202,93 @@ static inline DWORD get_config_key( HKEY defkey, HKEY appkey, const char *name,
 }
 
 
+/***********************************************************************
+ *		setup_options
+ *
+ * Read the driver configuration. The registry provides the defaults and
+ * the per-app values, the WINE_VK_* environment variables override them.
+ */
+static void setup_options(void)
+{
+    char buffer[MAX_PATH+16];
+    HKEY hkey, appkey = 0;
+    DWORD len;
+    const char *env;
+
+    /* @@ Wine registry key: HKCU\Software\Wine\Wayland Driver */
+    if (RegOpenKeyA( HKEY_CURRENT_USER, "Software\\Wine\\Wayland Driver", &hkey )) hkey = 0;
+
+    /* open the app-specific key */
+
+    len = (GetModuleFileNameA( 0, buffer, MAX_PATH ));
+    if (len && len < MAX_PATH)
+    {
+        HKEY tmpkey;
+        char *p, *appname = buffer;
+        if ((p = strrchr( appname, '/' ))) appname = p + 1;
+        if ((p = strrchr( appname, '\\' ))) appname = p + 1;
+        strcat( appname, "\\Wayland Driver" );
+        /* @@ Wine registry key: HKCU\Software\Wine\AppDefaults\app.exe\Wayland Driver */
+        if (!RegOpenKeyA( HKEY_CURRENT_USER, "Software\\Wine\\AppDefaults", &tmpkey ))
+        {
+            if (RegOpenKeyA( tmpkey, appname, &appkey )) appkey = 0;
+            RegCloseKey( tmpkey );
+        }
+    }
+
+    if (!get_config_key( hkey, appkey, "VulkanOnly", buffer, sizeof(buffer) ))
+        waylanddrv_config.vulkan_only = IS_OPTION_TRUE( buffer[0] );
+
+    if (!get_config_key( hkey, appkey, "HideCursor", buffer, sizeof(buffer) ))
+        waylanddrv_config.hide_cursor = IS_OPTION_TRUE( buffer[0] );
+
+    if (!get_config_key( hkey, appkey, "Width", buffer, sizeof(buffer) ))
+        waylanddrv_config.screen_width = atoi( buffer );
+
+    if (!get_config_key( hkey, appkey, "Height", buffer, sizeof(buffer) ))
+        waylanddrv_config.screen_height = atoi( buffer );
+
+    if (!get_config_key( hkey, appkey, "UseDmabuf", buffer, sizeof(buffer) ))
+        waylanddrv_config.use_dmabuf = IS_OPTION_TRUE( buffer[0] );
+
+    get_config_key( hkey, appkey, "IgnoredClasses", waylanddrv_config.ignored_classes,
+                    sizeof(waylanddrv_config.ignored_classes) );
+    get_config_key( hkey, appkey, "InputRecord", waylanddrv_config.input_record,
+                    sizeof(waylanddrv_config.input_record) );
+    get_config_key( hkey, appkey, "InputReplay", waylanddrv_config.input_replay,
+                    sizeof(waylanddrv_config.input_replay) );
+
+    if (!get_config_key( hkey, appkey, "WinDataStress", buffer, sizeof(buffer) ))
+        waylanddrv_config.win_data_stress = IS_OPTION_TRUE( buffer[0] );
+
+    if (appkey) RegCloseKey( appkey );
+    if (hkey) RegCloseKey( hkey );
+
+    /* the environment variables only need to be set, whatever their value */
+    if (getenv( "WINE_VK_VULKAN_ONLY" )) waylanddrv_config.vulkan_only = TRUE;
+    if (getenv( "WINE_VK_HIDE_CURSOR" )) waylanddrv_config.hide_cursor = TRUE;
+    if ((env = getenv( "WINE_VK_WAYLAND_WIDTH" ))) waylanddrv_config.screen_width = atoi( env );
+    if ((env = getenv( "WINE_VK_WAYLAND_HEIGHT" ))) waylanddrv_config.screen_height = atoi( env );
+    if (getenv( "WINE_VK_NO_DMABUF" )) waylanddrv_config.use_dmabuf = FALSE;
+    if ((env = getenv( "WINE_VK_IGNORED_CLASSES" )))
+        lstrcpynA( waylanddrv_config.ignored_classes, env, sizeof(waylanddrv_config.ignored_classes) );
+    if ((env = getenv( "WINE_VK_INPUT_RECORD" )))
+        lstrcpynA( waylanddrv_config.input_record, env, sizeof(waylanddrv_config.input_record) );
+    if ((env = getenv( "WINE_VK_INPUT_REPLAY" )))
+        lstrcpynA( waylanddrv_config.input_replay, env, sizeof(waylanddrv_config.input_replay) );
+    if (getenv( "WINE_VK_WIN_DATA_STRESS" )) waylanddrv_config.win_data_stress = TRUE;
+
+    if (waylanddrv_config.screen_width <= 0) waylanddrv_config.screen_width = 1600;
+    if (waylanddrv_config.screen_height <= 0) waylanddrv_config.screen_height = 900;
+
+    TRACE( "vulkan_only %d hide_cursor %d screen %dx%d ignored classes %s dmabuf %d record %s replay %s\n",
+           waylanddrv_config.vulkan_only, waylanddrv_config.hide_cursor,
+           waylanddrv_config.screen_width, waylanddrv_config.screen_height,
+           debugstr_a(waylanddrv_config.ignored_classes), waylanddrv_config.use_dmabuf,
+           debugstr_a(waylanddrv_config.input_record), debugstr_a(waylanddrv_config.input_replay) );
+}
+
+
 
 static void init_visuals( int screen )
 {
@@ -321,26 +421,16 @@ static BOOL process_attach(void)
     
   
   
-    char *env_width = getenv( "WINE_VK_WAYLAND_WIDTH" );
-    char *env_height = getenv( "WINE_VK_WAYLAND_HEIGHT" );
-    
-    int screen_width = 1600;
-    int screen_height = 900;
-    
-    if(env_width) {
-      screen_width = atoi(env_width);
-    }
-    if(env_height) {
-      screen_height = atoi(env_height);
-    }
+    setup_options();
+    if (waylanddrv_config.win_data_stress) wayland_win_data_stress_test();
     
     init_visuals( 0);
     //screen_bpp = pixmap_formats[default_visual.depth]->bits_per_pixel;
     screen_bpp = 24;
     
-     TRACE( "Creating desktop %d %d \n\n", screen_width , screen_height ); 
+     TRACE( "Creating desktop %d %d \n\n", waylanddrv_config.screen_width, waylanddrv_config.screen_height ); 
     
-    xinerama_init( screen_width , screen_height); 
+    xinerama_init( waylanddrv_config.screen_width, waylanddrv_config.screen_height ); 
     
     //esync
     set_queue_display_fd( 0 );
@@ -0,0 +1,121 @@
+/*
+ * Wayland window class handling
+ *
+ * Copyright 2020 varmd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "windef.h"
+#include "winbase.h"
+#include "winuser.h"
+
+#include "waylanddrv.h"
+#include "wine/debug.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(waylanddrv);
+
+/* classes of helper windows that never get a wayland surface */
+static const char * const default_ignored_classes[] =
+{
+    "Message",
+    "OleMainThreadWndClass",
+    "IME",
+    "#32769",           /* desktop */
+    "tooltips_class32",
+};
+
+/* classes that must not get the vulkan surface */
+static const char * const no_vulkan_classes[] =
+{
+    "PdxDetectWindow",  /* Paradox launcher detection window */
+};
+
+#define CLASS_FLAGS_VALID 0x80
+
+/* flags of each class atom, 0 until the class has been classified. Class
+ * atoms are 16-bit so a flat table gives a lookup without locking, a
+ * racing classification just stores the same value twice */
+static BYTE class_flags[0x10000];
+
+static BOOL class_in_list( const char *name, const char * const *list, unsigned int count )
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) if (!strcasecmp( name, list[i] )) return TRUE;
+    return FALSE;
+}
+
+/* match against the comma separated IgnoredClasses option */
+static BOOL class_in_option( const char *name, const char *option )
+{
+    size_t len = strlen( name );
+    const char *p = option, *end;
+
+    while (*p)
+    {
+        while (*p == ',' || *p == ' ') p++;
+        end = p;
+        while (*end && *end != ',') end++;
+        if ((size_t)(end - p) == len && !strncasecmp( p, name, len )) return TRUE;
+        p = end;
+    }
+    return FALSE;
+}
+
+static BYTE classify_window_class( HWND hwnd )
+{
+    WCHAR nameW[256];
+    char name[256];
+    BYTE flags = CLASS_FLAGS_VALID;
+
+    if (!GetClassNameW( hwnd, nameW, ARRAY_SIZE(nameW) )) return 0;
+    WideCharToMultiByte( CP_UTF8, 0, nameW, -1, name, sizeof(name), NULL, NULL );
+
+    if (class_in_list( name, default_ignored_classes, ARRAY_SIZE(default_ignored_classes) ) ||
+        class_in_option( name, waylanddrv_config.ignored_classes ))
+        flags |= WAYLANDDRV_CLASS_IGNORED;
+    if (class_in_list( name, no_vulkan_classes, ARRAY_SIZE(no_vulkan_classes) ))
+        flags |= WAYLANDDRV_CLASS_NO_VULKAN;
+
+    TRACE( "class %s flags %#x\n", debugstr_a(name), flags & ~CLASS_FLAGS_VALID );
+    return flags;
+}
+
+/***********************************************************************
+ *		get_window_class_flags
+ *
+ * Return the WAYLANDDRV_CLASS_* flags of the class of a window. The class
+ * name is only looked up the first time a class atom is seen.
+ */
+UINT get_window_class_flags( HWND hwnd )
+{
+    ATOM atom = GetClassLongW( hwnd, GCW_ATOM );
+    BYTE flags;
+
+    if (!atom) return 0;
+    if (!(flags = class_flags[atom]))
+    {
+        if (!(flags = classify_window_class( hwnd ))) return 0;
+        class_flags[atom] = flags;
+    }
+    return flags & ~CLASS_FLAGS_VALID;
+}
@@ -24,10 +24,10 @@
 # Cursor
 @ cdecl GetCursorPos(ptr) WAYLANDDRV_GetCursorPos
 
-# @ cdecl DestroyCursorIcon(long) WAYLANDDRV_DestroyCursorIcon
-# @ cdecl SetCursor(long) WAYLANDDRV_SetCursor
+@ cdecl DestroyCursorIcon(long) WAYLANDDRV_DestroyCursorIcon
+@ cdecl SetCursor(long) WAYLANDDRV_SetCursor
 
-# @ cdecl SetCursorPos(long long) WAYLANDDRV_SetCursorPos
+@ cdecl SetCursorPos(long long) WAYLANDDRV_SetCursorPos
 @ cdecl ClipCursor(ptr) WAYLANDDRV_ClipCursor
 
 @ cdecl ChangeDisplaySettingsEx(ptr ptr long long long) WAYLANDDRV_ChangeDisplaySettingsEx
@@ -51,11 +51,11 @@
 @ cdecl ReleaseCapture( ) WAYLANDDRV_ReleaseCapture
 
 # @ cdecl SetFocus(long) WAYLANDDRV_SetFocus
-# @ cdecl SetLayeredWindowAttributes(long long long long) WAYLANDDRV_SetLayeredWindowAttributes
+@ cdecl SetLayeredWindowAttributes(long long long long) WAYLANDDRV_SetLayeredWindowAttributes
 @ cdecl SetParent(long long long) WAYLANDDRV_SetParent
 
 # @ cdecl SetWindowIcon(long long long) WAYLANDDRV_SetWindowIcon
-# @ cdecl SetWindowRgn(long long long) WAYLANDDRV_SetWindowRgn
+@ cdecl SetWindowRgn(long long long) WAYLANDDRV_SetWindowRgn
 # @ cdecl SetWindowStyle(ptr long ptr) WAYLANDDRV_SetWindowStyle
 # @ cdecl SetWindowText(long wstr) WAYLANDDRV_SetWindowText
 
@@ -67,7 +67,7 @@
 
 #@ cdecl UpdateLayeredWindow(long ptr ptr) WAYLANDDRV_UpdateLayeredWindow
 
-#@ cdecl WindowMessage(long long long long) WAYLANDDRV_WindowMessage
+@ cdecl WindowMessage(long long long long) WAYLANDDRV_WindowMessage
 
 @ cdecl WindowPosChanging(long long long ptr ptr ptr ptr) WAYLANDDRV_WindowPosChanging
 
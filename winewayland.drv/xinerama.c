@@ -24,17 +24,47 @@
 
 #include <stdarg.h>
 #include <stdlib.h>
+#include <limits.h>
 
 
 #include "wine/library.h"
 #include "waylanddrv.h"
 #include "wine/debug.h"
+#include "wine/heap.h"
+#include "wine/list.h"
 #include "wine/unicode.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(waylanddrv);
 
 static RECT virtual_screen_rect;
 
+/* a wl_output global, as advertised by the compositor */
+struct wayland_output
+{
+    struct list        entry;
+    struct wl_output  *output;
+    uint32_t           name;       /* registry name */
+    int                x, y;       /* position in the compositor space */
+    int                width;      /* current mode */
+    int                height;
+    int                refresh;    /* in mHz */
+    int                scale;
+    BOOL               done;       /* received a complete set of properties */
+};
+
+static struct list outputs = LIST_INIT( outputs );
+static BOOL outputs_ready;
+static unsigned int default_width = 1600, default_height = 900;
+
+static CRITICAL_SECTION xinerama_section;
+static CRITICAL_SECTION_DEBUG critsect_debug =
+{
+    0, 0, &xinerama_section,
+    { &critsect_debug.ProcessLocksList, &critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": xinerama_section") }
+};
+static CRITICAL_SECTION xinerama_section = { &critsect_debug, -1, 0, 0, 0, 0 };
+
 static MONITORINFOEXW default_monitor =
 {
     sizeof(default_monitor),    /* cbSize */
@@ -46,6 +76,7 @@ static MONITORINFOEXW default_monitor =
 static const WCHAR monitor_deviceW[] = { '\\','\\','.','\\','D','I','S','P','L','A','Y','%','d',0 };
 
 static MONITORINFOEXW *monitors;
+static struct wl_output **monitor_outputs;
 static int nb_monitors;
 
 static inline MONITORINFOEXW *get_primary(void)
@@ -72,9 +103,92 @@ static void query_work_area( RECT *rc_work )
 }
 
 
-static inline int query_screens(void)
+static inline BOOL output_usable( const struct wayland_output *output )
+{
+    return output->done && output->width && output->height;
+}
+
+/* Physical origin of an output along one axis. Positions are logical and
+ * modes physical, so the outputs can't simply be scaled by their own scale
+ * when the scales differ. The origins are walked in logical order, each
+ * logical step is scaled by the outputs at the previous origin and clamped
+ * to their physical size, which keeps adjacent outputs adjacent. wl_output
+ * only reports integer scales, fractional scales are rounded up by the
+ * compositor and the clamp absorbs the difference. */
+static int get_physical_origin( const struct wayland_output *target, BOOL vertical )
+{
+    struct wayland_output *output;
+    int pos, next, prev = 0, prev_size = 0, prev_scale = 1, phys = 0;
+    int target_pos = vertical ? target->y : target->x;
+    BOOL first = TRUE;
+
+    for (;;)
+    {
+        next = INT_MAX;
+        LIST_FOR_EACH_ENTRY( output, &outputs, struct wayland_output, entry )
+        {
+            if (!output_usable( output )) continue;
+            pos = vertical ? output->y : output->x;
+            if ((first || pos > prev) && pos < next) next = pos;
+        }
+        if (!first) phys += min( (next - prev) * prev_scale, prev_size );
+        if (next >= target_pos) return phys;
+
+        prev_size = 0;
+        prev_scale = 1;
+        LIST_FOR_EACH_ENTRY( output, &outputs, struct wayland_output, entry )
+        {
+            if (!output_usable( output ) || (vertical ? output->y : output->x) != next) continue;
+            prev_size = max( prev_size, vertical ? output->height : output->width );
+            prev_scale = max( prev_scale, output->scale );
+        }
+        prev = next;
+        first = FALSE;
+    }
+}
+
+/* build the monitor list from the outputs, the first one being the primary */
+static int query_screens(void)
 {
-    return 0;
+    struct wayland_output *output;
+    MONITORINFOEXW *new_monitors;
+    struct wl_output **new_outputs;
+    int i, x, y, count = 0;
+
+    LIST_FOR_EACH_ENTRY( output, &outputs, struct wayland_output, entry )
+        if (output_usable( output )) count++;
+
+    if (!count) return 0;
+    if (!(new_monitors = heap_calloc( count, sizeof(*new_monitors) ))) return 0;
+    if (!(new_outputs = heap_calloc( count, sizeof(*new_outputs) )))
+    {
+        heap_free( new_monitors );
+        return 0;
+    }
+
+    i = 0;
+    LIST_FOR_EACH_ENTRY( output, &outputs, struct wayland_output, entry )
+    {
+        if (!output_usable( output )) continue;
+
+        new_monitors[i].cbSize = sizeof( new_monitors[i] );
+        /* modes are in physical pixels which is what we report so that
+         * games render at the native pixel density */
+        x = get_physical_origin( output, FALSE );
+        y = get_physical_origin( output, TRUE );
+        SetRect( &new_monitors[i].rcMonitor, x, y, x + output->width, y + output->height );
+        new_monitors[i].rcWork = new_monitors[i].rcMonitor;
+        new_monitors[i].dwFlags = i ? 0 : MONITORINFOF_PRIMARY;
+        sprintfW( new_monitors[i].szDevice, monitor_deviceW, i + 1 );
+        new_outputs[i] = output->output;
+        i++;
+    }
+
+    if (monitors != &default_monitor) heap_free( monitors );
+    heap_free( monitor_outputs );
+    monitors = new_monitors;
+    monitor_outputs = new_outputs;
+    return count;
 }
 
 POINT virtual_screen_to_root( INT x, INT y )
@@ -97,12 +211,53 @@ POINT root_to_virtual_screen( INT x, INT y )
 
 RECT get_virtual_screen_rect(void)
 {
-    return virtual_screen_rect;
+    RECT rect;
+
+    EnterCriticalSection( &xinerama_section );
+    rect = virtual_screen_rect;
+    LeaveCriticalSection( &xinerama_section );
+    return rect;
 }
 
 RECT get_primary_monitor_rect(void)
 {
-    return get_primary()->rcMonitor;
+    RECT rect;
+
+    EnterCriticalSection( &xinerama_section );
+    rect = get_primary()->rcMonitor;
+    LeaveCriticalSection( &xinerama_section );
+    return rect;
+}
+
+/***********************************************************************
+ *		wayland_output_for_rect
+ *
+ * Return the output of the monitor that has the largest intersection
+ * with the rectangle, for fullscreen requests.
+ */
+struct wl_output *wayland_output_for_rect( const RECT *rect )
+{
+    struct wl_output *ret = NULL;
+    int i, area, best = 0;
+    RECT intersect;
+
+    EnterCriticalSection( &xinerama_section );
+    if (monitor_outputs)
+    {
+        ret = monitor_outputs[0];
+        for (i = 0; i < nb_monitors; i++)
+        {
+            if (!IntersectRect( &intersect, &monitors[i].rcMonitor, rect )) continue;
+            area = (intersect.right - intersect.left) * (intersect.bottom - intersect.top);
+            if (area > best)
+            {
+                best = area;
+                ret = monitor_outputs[i];
+            }
+        }
+    }
+    LeaveCriticalSection( &xinerama_section );
+    return ret;
 }
 
 void xinerama_init( unsigned int width, unsigned int height )
@@ -111,13 +266,21 @@ void xinerama_init( unsigned int width, unsigned int height )
     int i;
     RECT rect;
 
+    EnterCriticalSection( &xinerama_section );
+
+    default_width = width;
+    default_height = height;
     SetRect( &rect, 0, 0, width, height );
 
-    default_monitor.rcWork = default_monitor.rcMonitor = rect;
-        
-    nb_monitors = 1;
-    monitors = &default_monitor;
-    
+    if (!(nb_monitors = query_screens()))
+    {
+        default_monitor.rcWork = default_monitor.rcMonitor = rect;
+        if (monitors != &default_monitor) heap_free( monitors );
+        heap_free( monitor_outputs );
+        monitor_outputs = NULL;
+        nb_monitors = 1;
+        monitors = &default_monitor;
+    }
 
     primary = get_primary();
     SetRectEmpty( &virtual_screen_rect );
@@ -137,32 +300,34 @@ void xinerama_init( unsigned int width, unsigned int height )
 
     TRACE( "virtual size: %s primary: %s\n",
            wine_dbgstr_rect(&virtual_screen_rect), wine_dbgstr_rect(&primary->rcMonitor) );
-}
 
+    LeaveCriticalSection( &xinerama_section );
+}
 
 /***********************************************************************
  *		WAYLANDDRV_GetMonitorInfo  (WAYLANDDRV.@)
  */
 BOOL CDECL WAYLANDDRV_GetMonitorInfo( HMONITOR handle, LPMONITORINFO info )
 {
-    
-  
-    int i = monitor_to_index( handle );
-  
-    i = 0;
+    int i;
 
-    /*
-    if (i == -1)
+    EnterCriticalSection( &xinerama_section );
+
+    /* monitors may have been unplugged since the handle was returned,
+     * fall back to the primary like we always did */
+    if ((i = monitor_to_index( handle )) == -1)
     {
-        SetLastError( ERROR_INVALID_HANDLE );
-        return FALSE;
+        WARN( "invalid monitor %p, using the primary\n", handle );
+        i = get_primary() - monitors;
     }
-  */
+
     info->rcMonitor = monitors[i].rcMonitor;
     info->rcWork = monitors[i].rcWork;
     info->dwFlags = monitors[i].dwFlags;
     if (info->cbSize >= sizeof(MONITORINFOEXW))
         lstrcpyW( ((MONITORINFOEXW *)info)->szDevice, monitors[i].szDevice );
+
+    LeaveCriticalSection( &xinerama_section );
     return TRUE;
 }
 
@@ -172,9 +337,221 @@ BOOL CDECL WAYLANDDRV_GetMonitorInfo( HMONITOR handle, LPMONITORINFO info )
  */
 BOOL CDECL WAYLANDDRV_EnumDisplayMonitors( HDC hdc, LPRECT rect, MONITORENUMPROC proc, LPARAM lp )
 {
-    
-    proc( index_to_monitor(0), 0, &monitors[0].rcMonitor, lp );
-    return TRUE;
-  
+    RECT *monrects, limit, monrect;
+    POINT origin = { 0, 0 };
+    BOOL ret = TRUE;
+    int i, count;
+
+    if (hdc)
+    {
+        if (!GetDCOrgEx( hdc, &origin )) return FALSE;
+        if (GetClipBox( hdc, &limit ) == ERROR) return FALSE;
+        if (rect && !IntersectRect( &limit, &limit, rect )) return TRUE;
+        rect = &limit;
+    }
+
+    /* don't call back into the application with the lock held */
+    EnterCriticalSection( &xinerama_section );
+    count = nb_monitors;
+    if ((monrects = heap_calloc( count, sizeof(*monrects) )))
+        for (i = 0; i < count; i++) monrects[i] = monitors[i].rcMonitor;
+    LeaveCriticalSection( &xinerama_section );
+
+    if (!monrects) return FALSE;
+
+    for (i = 0; i < count; i++)
+    {
+        monrect = monrects[i];
+        OffsetRect( &monrect, -origin.x, -origin.y );
+        if (rect && !IntersectRect( &monrect, &monrect, rect )) continue;
+        if (!(ret = proc( index_to_monitor(i), hdc, &monrect, lp ))) break;
+    }
+
+    heap_free( monrects );
+    return ret;
+}
+
+
+/* update the monitors after an output change, and let the applications
+ * know about it once the initial set of outputs has been received */
+static void update_outputs(void)
+{
+    RECT old_rect, new_rect;
+
+    old_rect = get_virtual_screen_rect();
+    xinerama_init( default_width, default_height );
+    new_rect = get_virtual_screen_rect();
 
+    if (!outputs_ready || EqualRect( &old_rect, &new_rect )) return;
+
+    TRACE( "virtual screen changed from %s to %s\n",
+           wine_dbgstr_rect(&old_rect), wine_dbgstr_rect(&new_rect) );
+    /* this runs on the event thread, posting keeps a hung window from
+     * stalling the input dispatch */
+    PostMessageW( HWND_BROADCAST, WM_DISPLAYCHANGE, screen_bpp,
+                  MAKELPARAM( new_rect.right - new_rect.left, new_rect.bottom - new_rect.top ) );
+}
+
+static void output_handle_geometry( void *data, struct wl_output *wl_output, int32_t x, int32_t y,
+                                    int32_t physical_width, int32_t physical_height, int32_t subpixel,
+                                    const char *make, const char *model, int32_t transform )
+{
+    struct wayland_output *output = data;
+
+    TRACE( "output %u: %s %s at %d,%d\n", output->name, debugstr_a(make), debugstr_a(model), x, y );
+
+    EnterCriticalSection( &xinerama_section );
+    output->x = x;
+    output->y = y;
+    LeaveCriticalSection( &xinerama_section );
+}
+
+static void output_handle_mode( void *data, struct wl_output *wl_output, uint32_t flags,
+                                int32_t width, int32_t height, int32_t refresh )
+{
+    struct wayland_output *output = data;
+
+    if (!(flags & WL_OUTPUT_MODE_CURRENT)) return;
+
+    TRACE( "output %u: %dx%d@%d\n", output->name, width, height, refresh );
+
+    EnterCriticalSection( &xinerama_section );
+    output->width = width;
+    output->height = height;
+    output->refresh = refresh;
+    LeaveCriticalSection( &xinerama_section );
+
+    /* version 1 outputs have no done event */
+    if (wl_output_get_version( wl_output ) < WL_OUTPUT_DONE_SINCE_VERSION) output->done = TRUE;
+    if (output->done) update_outputs();
+}
+
+static void output_handle_done( void *data, struct wl_output *wl_output )
+{
+    struct wayland_output *output = data;
+
+    output->done = TRUE;
+    update_outputs();
+}
+
+static void output_handle_scale( void *data, struct wl_output *wl_output, int32_t scale )
+{
+    struct wayland_output *output = data;
+
+    TRACE( "output %u: scale %d\n", output->name, scale );
+
+    EnterCriticalSection( &xinerama_section );
+    output->scale = scale;
+    LeaveCriticalSection( &xinerama_section );
+}
+
+static const struct wl_output_listener output_listener =
+{
+    output_handle_geometry,
+    output_handle_mode,
+    output_handle_done,
+    output_handle_scale
+};
+
+/***********************************************************************
+ *		wayland_output_get_scale
+ *
+ * Return the integer scale of an output, 1 if unknown.
+ */
+int wayland_output_get_scale( struct wl_output *wl_output )
+{
+    struct wayland_output *output;
+    int scale = 1;
+
+    EnterCriticalSection( &xinerama_section );
+    LIST_FOR_EACH_ENTRY( output, &outputs, struct wayland_output, entry )
+    {
+        if (output->output != wl_output) continue;
+        scale = output->scale;
+        break;
+    }
+    LeaveCriticalSection( &xinerama_section );
+    return scale;
+}
+
+/***********************************************************************
+ *		wayland_output_get_mode
+ *
+ * Return the current mode of an output, in physical pixels.
+ */
+BOOL wayland_output_get_mode( struct wl_output *wl_output, int *width, int *height )
+{
+    struct wayland_output *output;
+    BOOL ret = FALSE;
+
+    EnterCriticalSection( &xinerama_section );
+    LIST_FOR_EACH_ENTRY( output, &outputs, struct wayland_output, entry )
+    {
+        if (output->output != wl_output) continue;
+        *width = output->width;
+        *height = output->height;
+        ret = output->width && output->height;
+        break;
+    }
+    LeaveCriticalSection( &xinerama_section );
+    return ret;
+}
+
+/***********************************************************************
+ *		wayland_output_add
+ *
+ * Bind a wl_output global announced by the registry.
+ */
+void wayland_output_add( struct wl_registry *registry, uint32_t name, uint32_t version )
+{
+    struct wayland_output *output;
+
+    if (!(output = heap_alloc_zero( sizeof(*output) ))) return;
+
+    output->name = name;
+    output->scale = 1;
+    output->output = wl_registry_bind( registry, name, &wl_output_interface, min( version, 2 ) );
+    wl_output_add_listener( output->output, &output_listener, output );
+
+    EnterCriticalSection( &xinerama_section );
+    list_add_tail( &outputs, &output->entry );
+    LeaveCriticalSection( &xinerama_section );
+}
+
+/***********************************************************************
+ *		wayland_output_remove
+ *
+ * Handle the removal of a registry global, returns FALSE if it isn't an output.
+ */
+BOOL wayland_output_remove( uint32_t name )
+{
+    struct wayland_output *output;
+
+    EnterCriticalSection( &xinerama_section );
+    LIST_FOR_EACH_ENTRY( output, &outputs, struct wayland_output, entry )
+    {
+        if (output->name != name) continue;
+        list_remove( &output->entry );
+        LeaveCriticalSection( &xinerama_section );
+
+        TRACE( "output %u removed\n", name );
+        update_outputs();
+        wl_output_destroy( output->output );
+        heap_free( output );
+        return TRUE;
+    }
+    LeaveCriticalSection( &xinerama_section );
+    return FALSE;
+}
+
+/***********************************************************************
+ *		wayland_outputs_ready
+ *
+ * Called once the initial registry roundtrips are done; later output
+ * changes are broadcast to the applications.
+ */
+void wayland_outputs_ready(void)
+{
+    update_outputs();
+    outputs_ready = TRUE;
 }